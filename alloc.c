@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "alloc.h"
+
+// To know how much memory is live (and how many times something has been
+// grown) we need the size of every allocation at free/realloc time. Rather
+// than put a header in front of every block, which would have to be there
+// whether accounting was on or not, live blocks are kept in a side table:
+// an open-addressed hash from pointer to size, which only exists in -A
+// mode. The table itself uses plain malloc so it doesn't account for
+// itself.
+//
+// Counters are kept twice: once for the current line, reset by
+// alloc_line_begin(), and once for the whole session.
+
+typedef struct {
+    uintptr_t ptr; // 0 is an empty slot.
+    size_t    size;
+    uint32_t  chain;
+} alloc_ent_t;
+
+int alloc_prof = 0;
+
+static _Thread_local int alloc_stage = ALLOC_OTHER;
+
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static alloc_ent_t*    alloc_tab = NULL;
+static size_t          alloc_cap = 0, alloc_used = 0;
+
+static alloc_stats_t   alloc_line[ALLOC_STAGES];
+static alloc_stats_t   alloc_total[ALLOC_STAGES];
+static uint64_t        alloc_live = 0;
+static uint64_t        alloc_line_peak = 0, alloc_total_peak = 0;
+
+static const char* alloc_stage_names[ALLOC_STAGES] = {
+    "other", "read_input", "split_line", "expand_vars",
+    "resolve", "capture", "execute",
+};
+
+void alloc_prof_enable() {
+    alloc_prof = 1;
+}
+
+/* Charges allocations to stage until the matching alloc_stage_leave(),
+ * which must be passed the return value.
+ */
+int alloc_stage_enter(int stage) {
+    int prev = alloc_stage;
+    alloc_stage = stage;
+    return prev;
+}
+
+void alloc_stage_leave(int prev) {
+    alloc_stage = prev;
+}
+
+static size_t alloc_slot(uintptr_t ptr) {
+    // Fibonacci hashing; malloc'd pointers have their low bits clear,
+    // so those are useless on their own.
+    return ((ptr >> 4) * 0x9E3779B97F4A7C15ull) & (alloc_cap - 1);
+}
+
+static alloc_ent_t* alloc_find(uintptr_t ptr) {
+    if (!alloc_cap)
+        return NULL;
+    for (size_t at = alloc_slot(ptr); alloc_tab[at].ptr; at = (at + 1) & (alloc_cap - 1)) {
+        if (alloc_tab[at].ptr == ptr)
+            return &alloc_tab[at];
+    }
+    return NULL;
+}
+
+static void alloc_insert(alloc_ent_t ent) {
+    if ((alloc_used + 1) * 2 > alloc_cap) {
+        alloc_ent_t* old = alloc_tab;
+        size_t old_cap = alloc_cap;
+
+        alloc_cap = alloc_cap ? alloc_cap * 2 : 1024;
+        alloc_tab = calloc(alloc_cap, sizeof(alloc_ent_t));
+        if (!alloc_tab) {
+            perror("err: alloc_insert: \n");
+            exit(EXIT_FAILURE);
+        }
+
+        alloc_used = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].ptr)
+                alloc_insert(old[i]);
+        }
+        free(old);
+    }
+
+    size_t at = alloc_slot(ent.ptr);
+    while (alloc_tab[at].ptr)
+        at = (at + 1) & (alloc_cap - 1);
+    alloc_tab[at] = ent;
+    alloc_used++;
+}
+
+static void alloc_remove(alloc_ent_t* ent) {
+    // Linear probing; shift back any following entries which would no
+    // longer be reachable past the hole.
+    size_t hole = ent - alloc_tab;
+    size_t at = hole;
+    alloc_tab[hole].ptr = 0;
+    alloc_used--;
+
+    while (1) {
+        at = (at + 1) & (alloc_cap - 1);
+        if (!alloc_tab[at].ptr)
+            break;
+        size_t home = alloc_slot(alloc_tab[at].ptr);
+        if (((at - home) & (alloc_cap - 1)) >= ((at - hole) & (alloc_cap - 1))) {
+            alloc_tab[hole] = alloc_tab[at];
+            alloc_tab[at].ptr = 0;
+            hole = at;
+        }
+    }
+}
+
+// Bumps a counter for the current stage, in both the line and session
+// totals.
+#define ALLOC_ADD(field, n) do { \
+        alloc_line[alloc_stage].field  += (n); \
+        alloc_total[alloc_stage].field += (n); \
+    } while (0)
+
+static void alloc_chain(uint32_t chain) {
+    if (chain == 1)
+        ALLOC_ADD(chains, 1);
+    if (chain > alloc_line[alloc_stage].chain_max)
+        alloc_line[alloc_stage].chain_max = chain;
+    if (chain > alloc_total[alloc_stage].chain_max)
+        alloc_total[alloc_stage].chain_max = chain;
+}
+
+static void alloc_live_add(int64_t n) {
+    alloc_live += n;
+    if (alloc_live > alloc_line_peak)
+        alloc_line_peak = alloc_live;
+    if (alloc_live > alloc_total_peak)
+        alloc_total_peak = alloc_live;
+}
+
+void alloc_note_malloc(void* ptr, size_t size) {
+    pthread_mutex_lock(&alloc_lock);
+    alloc_insert((alloc_ent_t){ (uintptr_t)ptr, size, 0 });
+    ALLOC_ADD(mallocs, 1);
+    ALLOC_ADD(bytes, size);
+    alloc_live_add(size);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void alloc_note_realloc(uintptr_t old, void* ptr, size_t size) {
+    pthread_mutex_lock(&alloc_lock);
+
+    alloc_ent_t* ent = old ? alloc_find(old) : NULL;
+    size_t   old_size = ent ? ent->size : 0;
+    uint32_t chain = ent ? ent->chain + 1 : 0;
+    if (ent)
+        alloc_remove(ent);
+    alloc_insert((alloc_ent_t){ (uintptr_t)ptr, size, chain });
+
+    if (old) {
+        ALLOC_ADD(reallocs, 1);
+        alloc_chain(chain);
+    } else {
+        ALLOC_ADD(mallocs, 1); // realloc(NULL, n) is just malloc.
+    }
+    if (size > old_size)
+        ALLOC_ADD(bytes, size - old_size);
+    alloc_live_add((int64_t)size - (int64_t)old_size);
+
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void alloc_note_free(void* ptr) {
+    pthread_mutex_lock(&alloc_lock);
+
+    // Anything allocated before accounting was switched on isn't in the
+    // table; it still counts as a free, but there's no size to take off.
+    alloc_ent_t* ent = alloc_find((uintptr_t)ptr);
+    if (ent) {
+        alloc_live_add(-(int64_t)ent->size);
+        alloc_remove(ent);
+    }
+    ALLOC_ADD(frees, 1);
+
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void alloc_line_begin() {
+    pthread_mutex_lock(&alloc_lock);
+    memset(alloc_line, 0, sizeof(alloc_line));
+    alloc_line_peak = alloc_live;
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+/* Formats a table of the counters for the last line, or for the whole
+ * session, into buf. Returns the length, as snprintf would.
+ */
+int alloc_report(char* buf, size_t len, int session) {
+    pthread_mutex_lock(&alloc_lock);
+
+    alloc_stats_t* st = session ? alloc_total : alloc_line;
+    alloc_stats_t  sum;
+    int at = 0;
+    memset(&sum, 0, sizeof(sum));
+
+    #define REPORT(...) at += snprintf(&buf[at], (size_t)at < len ? len - at : 0, __VA_ARGS__)
+    REPORT("%-12s %10s %10s %10s %12s %8s %8s\n",
+           "stage", "mallocs", "reallocs", "frees", "bytes", "chains", "longest");
+    for (size_t i = 0; i < ALLOC_STAGES; i++) {
+        if (!st[i].mallocs && !st[i].reallocs && !st[i].frees)
+            continue;
+        REPORT("%-12s %10llu %10llu %10llu %12llu %8llu %8llu\n",
+               alloc_stage_names[i],
+               (unsigned long long)st[i].mallocs, (unsigned long long)st[i].reallocs,
+               (unsigned long long)st[i].frees, (unsigned long long)st[i].bytes,
+               (unsigned long long)st[i].chains, (unsigned long long)st[i].chain_max);
+        sum.mallocs  += st[i].mallocs;
+        sum.reallocs += st[i].reallocs;
+        sum.frees    += st[i].frees;
+        sum.bytes    += st[i].bytes;
+        sum.chains   += st[i].chains;
+        if (st[i].chain_max > sum.chain_max)
+            sum.chain_max = st[i].chain_max;
+    }
+    REPORT("%-12s %10llu %10llu %10llu %12llu %8llu %8llu\n", "total",
+           (unsigned long long)sum.mallocs, (unsigned long long)sum.reallocs,
+           (unsigned long long)sum.frees, (unsigned long long)sum.bytes,
+           (unsigned long long)sum.chains, (unsigned long long)sum.chain_max);
+    REPORT("peak live %llu bytes, now %llu bytes\n",
+           (unsigned long long)(session ? alloc_total_peak : alloc_line_peak),
+           (unsigned long long)alloc_live);
+    #undef REPORT
+
+    pthread_mutex_unlock(&alloc_lock);
+    return at;
+}
+
+void alloc_reset() {
+    pthread_mutex_lock(&alloc_lock);
+    memset(alloc_line, 0, sizeof(alloc_line));
+    memset(alloc_total, 0, sizeof(alloc_total));
+    alloc_line_peak = alloc_total_peak = alloc_live;
+    pthread_mutex_unlock(&alloc_lock);
+}
@@ -0,0 +1,45 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdint.h>
+
+// Allocation accounting. Off unless ysh is run with -A; when off, the
+// traps in util.c cost one branch each.
+//
+// Every allocation is charged to the stage of the shell that made it.
+// Stages nest; whichever was entered last wins until it's left again.
+enum {
+    ALLOC_OTHER = 0,
+    ALLOC_READ_INPUT,
+    ALLOC_SPLIT_LINE,
+    ALLOC_EXPAND_VARS,
+    ALLOC_RESOLVE,
+    ALLOC_CAPTURE,
+    ALLOC_EXECUTE,
+    ALLOC_STAGES
+};
+
+typedef struct {
+    uint64_t mallocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;     // Requested by malloc, plus growth by realloc.
+    uint64_t chains;    // Allocations which realloc grew at least once.
+    uint64_t chain_max; // Most reallocs of any one allocation.
+} alloc_stats_t;
+
+extern int alloc_prof;
+
+void alloc_prof_enable();
+int alloc_stage_enter(int stage);
+void alloc_stage_leave(int prev);
+
+void alloc_note_malloc(void* ptr, size_t size);
+void alloc_note_realloc(uintptr_t old, void* ptr, size_t size);
+void alloc_note_free(void* ptr);
+
+void alloc_line_begin();
+int alloc_report(char* buf, size_t len, int session);
+void alloc_reset();
+
+#endif
@@ -0,0 +1,126 @@
+// Thread scaling of libysh: every thread gets an interpreter of its own and
+// runs the same fixed amount of work, first on one thread, then two, and so
+// on up to the limit. With nothing shared between interpreters the time
+// taken should stay flat as threads are added, up to the number of CPUs.
+//
+// Each interpreter counts its iterations in a variable, which is checked
+// at the end; a count off by anything means two interpreters saw each
+// other's state.
+//
+//   bench/threads [-e] [-n iterations] [-t max_threads]
+//
+// -e runs an external command (true) per iteration instead of builtins
+// only, which mostly measures fork/exec and the child limit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ysh.h"
+
+typedef struct {
+    pthread_t   thread;
+    const char* line;
+    unsigned long iters;
+    int         ok;
+} worker_t;
+
+static int devnull = -1;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* worker(void* arg) {
+    worker_t* w = arg;
+    ysh_t* sh = ysh_new();
+    ysh_set_io(sh, devnull, devnull, 2);
+
+    ysh_set_var(sh, "n", "0");
+    ysh_run(sh, w->line);
+
+    const char* n = ysh_get_var(sh, "n");
+    w->ok = n && strtoul(n, NULL, 0) == w->iters;
+
+    ysh_free(sh);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    unsigned long iters = 20000;
+    long max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char* body = "= n {+ $n 1}";
+    int c;
+
+    while ((c = getopt(argc, argv, "en:t:")) != -1) {
+        switch (c) {
+            case 'e':
+                body = "= n {+ $n 1 {true}}";
+                iters = 2000;
+                break;
+            case 'n':
+                iters = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                max_threads = strtol(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-e] [-n iterations] [-t max_threads]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (max_threads < 1)
+        max_threads = 1;
+
+    devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    ysh_child_limit(0);
+
+    char line[128];
+    snprintf(line, sizeof(line), "repeat %lu '%s'", iters, body);
+
+    printf("%8s %12s %10s %14s %8s\n", "threads", "iterations", "seconds", "iterations/s", "scaling");
+
+    double base = 0;
+    int failed = 0;
+    for (long threads = 1; ; ) {
+        worker_t* w = calloc(threads, sizeof(worker_t));
+
+        double start = now();
+        for (long i = 0; i < threads; i++) {
+            w[i].line  = line;
+            w[i].iters = iters;
+            pthread_create(&w[i].thread, NULL, worker, &w[i]);
+        }
+        for (long i = 0; i < threads; i++) {
+            pthread_join(w[i].thread, NULL);
+            if (!w[i].ok)
+                failed = 1;
+        }
+        double secs = now() - start;
+
+        double rate = threads * iters / secs;
+        if (threads == 1)
+            base = rate;
+        printf("%8ld %12lu %10.3f %14.0f %7.2fx\n", threads, threads * iters, secs, rate, rate / base);
+
+        free(w);
+
+        // Doubling each time, but always finishing on max_threads.
+        if (threads == max_threads)
+            break;
+        threads = threads * 2 > max_threads ? max_threads : threads * 2;
+    }
+
+    if (failed) {
+        printf("FAILED: an interpreter's count was wrong\n");
+        return 1;
+    }
+    return 0;
+}
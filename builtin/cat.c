@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+static int cat_fd(int fd, cmd_io_t* io) {
+    if (!io->capture)
+        return fd_copy(fd, io->out);
+
+    // Subcommand; it has to end up in memory anyway.
+    char buf[65536];
+    ssize_t ret;
+    while ((ret = read(fd, buf, sizeof(buf))) > 0)
+        builtin_output(io, buf, ret);
+
+    return ret == -1 ? -1 : 0;
+}
+
+int builtin_cat(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    int ret = 0;
+
+    if (!argv[1] && cat_fd(io->in, io) == -1) {
+        dprintf(sh->err, "cat: %s\n", strerror(errno));
+        ret = -1;
+    }
+
+    for (size_t idx = 1; argv[idx]; idx++) {
+        int fd = openat(sh->cwd, argv[idx], O_RDONLY | O_CLOEXEC);
+        if (fd == -1 || cat_fd(fd, io) == -1) {
+            dprintf(sh->err, "cat: %s: %s\n", argv[idx], strerror(errno));
+            ret = -1;
+        }
+        if (fd != -1)
+            close(fd);
+    }
+
+    return ret;
+}
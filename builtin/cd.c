@@ -2,13 +2,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <ctype.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
-int builtin_chdir(char* nam, char** argv, char** stdout) {
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+// Only the interpreter's own directory changes (see ysh_chdir); children
+// are started in it, and redirections and cat open files from it.
+int builtin_chdir(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
     assert(nam);
     assert(argv[0]);
 
@@ -16,12 +23,15 @@ int builtin_chdir(char* nam, char** argv, char** stdout) {
 
     if (argv[1] == NULL) {
         // No path was provided in cd, so just go $HOME
+        const char* home = var_get(&sh->vars, "HOME");
+        if (home)
+            ret = ysh_chdir(sh, home);
     } else if (argv[1]) {
-        ret = chdir(argv[1]);
+        ret = ysh_chdir(sh, argv[1]);
     }
 
     if (ret == -1)
-        perror("cd");
+        dprintf(sh->err, "cd: %s: %s\n", argv[1] ? argv[1] : "$HOME", strerror(errno));
 
     return ret;
 }
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+static void history_print(hist_t* hist, size_t idx, cmd_io_t* io) {
+    const char* ent = history_get(hist, idx);
+    size_t len = strlen(ent);
+    char* line = malloc_trap(len + 32);
+    int sz = snprintf(line, len + 32, "%6zu  %s\n", idx + 1, ent);
+    builtin_output(io, line, sz);
+    free_trap(line);
+}
+
+// history [N]
+//   Print the last N entries, or all of them.
+// history -s TEXT [N]
+//   Print the N (default 1) most recent entries containing TEXT, newest
+//   first.
+int builtin_history(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (argv[1] && !strcmp(argv[1], "-s")) {
+        if (!argv[2]) {
+            dprintf(sh->err, "history: -s needs a search string\n");
+            return -1;
+        }
+        size_t want = argv[3] ? strtoul(argv[3], NULL, 0) : 1;
+        long at = history_count(&sh->hist);
+        for (size_t found = 0; found < want; found++) {
+            at = history_search(&sh->hist, argv[2], at);
+            if (at == -1)
+                break;
+            history_print(&sh->hist, at, io);
+        }
+    } else {
+        size_t count = history_count(&sh->hist);
+        size_t want = argv[1] ? strtoul(argv[1], NULL, 0) : count;
+        if (want > count)
+            want = count;
+        for (size_t idx = count - want; idx < count; idx++)
+            history_print(&sh->hist, idx, io);
+    }
+
+    return 0;
+}
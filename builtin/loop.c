@@ -0,0 +1,132 @@
+// Loops take their body as a single (usually single-quoted) argument and
+// parse it exactly once. Each iteration resolves that same tree into a
+// fresh command and runs it, so a loop of any length only pays for
+// tokenizing its body the one time. All of them stop early once the
+// current deadline (see timeout) has passed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+static int run_body(ysh_t* sh, ast_t* tmpl, cmd_io_t* io) {
+    ast_t* cmd = resolve(sh, tmpl);
+    int status;
+
+    if (io->capture) {
+        // As a subcommand, each iteration's output gets back the '\n'
+        // capturing took off it, the same as if it had been printed;
+        // run_command takes the last one off again.
+        char* out = NULL;
+        cmd_io_t sub = *io;
+        sub.capture = &out;
+        status = execute(sh, cmd, &sub);
+        if (out && *out) {
+            builtin_output(io, out, strlen(out));
+            builtin_output(io, "\n", 1);
+        }
+        free_trap(out);
+    } else {
+        status = execute(sh, cmd, io);
+    }
+
+    ast_free(cmd);
+    return status;
+}
+
+// repeat N BODY
+int builtin_repeat(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1] || !argv[2]) {
+        dprintf(sh->err, "repeat: usage: repeat count body\n");
+        return -1;
+    }
+
+    unsigned long long count = strtoull(argv[1], NULL, 0);
+    ast_t* body = parse(sh, argv[2]);
+    int status = 0;
+
+    for (unsigned long long i = 0; i < count && !deadline_expired(&sh->deadline); i++)
+        status = run_body(sh, body, io);
+
+    ast_free(body);
+    return status;
+}
+
+// for NAME ITEM... BODY
+//   Items are split on whitespace, so the output of a subcommand such as
+//   {seq 1 10} gives one iteration per word.
+int builtin_for(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    size_t argc = 0;
+    while (argv[argc])
+        argc++;
+
+    if (argc < 3) {
+        dprintf(sh->err, "for: usage: for name item... body\n");
+        return -1;
+    }
+
+    ast_t* body = parse(sh, argv[argc-1]);
+    int status = 0;
+
+    for (size_t idx = 2; idx < argc - 1; idx++) {
+        char* at = argv[idx];
+        while (*at && !deadline_expired(&sh->deadline)) {
+            while (isspace(*at))
+                at++;
+            if (!*at)
+                break;
+
+            char* end = at;
+            while (*end && !isspace(*end))
+                end++;
+
+            char* item = malloc_trap(end - at + 1);
+            memcpy(item, at, end - at);
+            item[end - at] = 0;
+            var_set(&sh->vars, argv[1], item);
+            free_trap(item);
+
+            status = run_body(sh, body, io);
+            at = end;
+        }
+    }
+
+    ast_free(body);
+    return status;
+}
+
+// while COND BODY
+//   Runs BODY for as long as COND exits with status 0.
+int builtin_while(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1] || !argv[2]) {
+        dprintf(sh->err, "while: usage: while cond body\n");
+        return -1;
+    }
+
+    ast_t* cond = parse(sh, argv[1]);
+    ast_t* body = parse(sh, argv[2]);
+    int status = 0;
+
+    while (!deadline_expired(&sh->deadline) && run_body(sh, cond, io) == 0)
+        status = run_body(sh, body, io);
+
+    ast_free(cond);
+    ast_free(body);
+    return status;
+}
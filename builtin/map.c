@@ -0,0 +1,337 @@
+// map and each run a body once per item, like for, but on a pool of
+// threads: every worker takes the next item as soon as it's done with the
+// last one, so a slow item never holds up the rest. Builtins run right
+// there on the worker's thread; external commands are started from it,
+// and wait for a child slot like any other (see ysh -j).
+//
+// Each worker gets a child interpreter of its own (ysh_child), which sees
+// the shell's variables without copying them, and is put back to those and
+// the shell's directory before every item (ysh_child_reset). That's where
+// the item is bound. So
+// nothing a body does (setting variables, cd) is seen by any other item,
+// whether on the same worker or not, or by the shell afterwards. Their
+// stats are added to the shell's once they're done.
+//
+// An item's output is collected and written all at once when it finishes,
+// so the output of different items is never mixed up; with each (or map
+// -k) it's also held back until everything before it has been written.
+
+// For RUSAGE_THREAD, which is Linux-only.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+typedef struct {
+    ysh_t*      sh;       // Only read until everything's done.
+    ast_t*      body;
+    const char* name;
+    int         item_in;  // Input for each item's command.
+
+    // Where items come from: the words of args, or else lines of in_fd.
+    pthread_mutex_t src_lock;
+    char**      args;
+    char*       arg_at;
+    int         in_fd;
+    char*       buf;
+    size_t      buf_len, buf_cap;
+    int         eof;
+    size_t      taken;    // Items handed out so far; the next one's index.
+
+    // Everything from here on is under out_lock.
+    pthread_mutex_t out_lock;
+    cmd_io_t*   io;
+    int         ordered;
+    char**      held;     // Finished output waiting for earlier items.
+    char*       done;
+    size_t      held_cap;
+    size_t      next_out; // Index of the next item to be written.
+
+    int         status;   // Of the earliest failed item, or 0.
+    size_t      status_idx;
+} pool_t;
+
+typedef struct {
+    pool_t*   pool;
+    ysh_t*    sh;
+    pthread_t thread;
+    int       thread_own; // Running on thread, not the shell's.
+} worker_t;
+
+static char* item_copy(const char* str, size_t len) {
+    char* item = malloc_trap(len + 1);
+    memcpy(item, str, len);
+    item[len] = 0;
+    return item;
+}
+
+// Next whitespace-separated word of the arguments, the same as for.
+static char* next_arg(pool_t* pool) {
+    while (*pool->args) {
+        if (!pool->arg_at)
+            pool->arg_at = *pool->args;
+
+        char* at = pool->arg_at;
+        while (isspace(*at))
+            at++;
+        if (*at) {
+            char* end = at;
+            while (*end && !isspace(*end))
+                end++;
+            pool->arg_at = end;
+            return item_copy(at, end - at);
+        }
+
+        pool->args++;
+        pool->arg_at = NULL;
+    }
+    return NULL;
+}
+
+// Next non-empty line of input. Lines are read as they're needed, so map
+// can start on the first items while the rest are still being produced.
+static char* next_line(pool_t* pool) {
+    while (1) {
+        char* nl = pool->buf_len ? memchr(pool->buf, '\n', pool->buf_len) : NULL;
+        if (nl || (pool->eof && pool->buf_len)) {
+            size_t len = nl ? (size_t)(nl - pool->buf) : pool->buf_len;
+            size_t used = nl ? len + 1 : len;
+            char* item = len ? item_copy(pool->buf, len) : NULL;
+            memmove(pool->buf, &pool->buf[used], pool->buf_len - used);
+            pool->buf_len -= used;
+            if (item)
+                return item;
+            continue;
+        }
+        if (pool->eof)
+            return NULL;
+
+        if (pool->buf_cap - pool->buf_len < 4096) {
+            pool->buf_cap = pool->buf_cap ? pool->buf_cap * 2 : 4096;
+            pool->buf = realloc_trap(pool->buf, pool->buf_cap);
+        }
+        ssize_t ret = read(pool->in_fd, &pool->buf[pool->buf_len], pool->buf_cap - pool->buf_len);
+        if (ret > 0)
+            pool->buf_len += ret;
+        else if (ret == 0 || errno != EINTR)
+            pool->eof = 1;
+    }
+}
+
+static char* next_item(pool_t* pool, size_t* idx) {
+    pthread_mutex_lock(&pool->src_lock);
+    char* item = pool->args ? next_arg(pool) : next_line(pool);
+    if (item)
+        *idx = pool->taken++;
+    pthread_mutex_unlock(&pool->src_lock);
+    return item;
+}
+
+// Writes one item's output with the '\n' capturing took off it, in the
+// same way a loop's iterations are. Called under out_lock.
+static void item_output(pool_t* pool, char* out) {
+    cmd_io_t* io = pool->io;
+    if (!out || !*out)
+        return;
+
+    builtin_output(io, out, strlen(out));
+    builtin_output(io, "\n", 1);
+}
+
+// Takes over out, the output of item idx.
+static void item_done(pool_t* pool, size_t idx, char* out, int status) {
+    pthread_mutex_lock(&pool->out_lock);
+
+    if (status && (!pool->status || idx < pool->status_idx)) {
+        pool->status = status;
+        pool->status_idx = idx;
+    }
+
+    if (!pool->ordered) {
+        item_output(pool, out);
+        free_trap(out);
+    } else {
+        if (idx >= pool->held_cap) {
+            size_t cap = pool->held_cap ? pool->held_cap * 2 : 64;
+            while (cap <= idx)
+                cap *= 2;
+            pool->held = realloc_trap(pool->held, cap * sizeof(char*));
+            pool->done = realloc_trap(pool->done, cap);
+            memset(&pool->done[pool->held_cap], 0, cap - pool->held_cap);
+            pool->held_cap = cap;
+        }
+        pool->held[idx] = out;
+        pool->done[idx] = 1;
+
+        while (pool->next_out < pool->held_cap && pool->done[pool->next_out]) {
+            item_output(pool, pool->held[pool->next_out]);
+            free_trap(pool->held[pool->next_out]);
+            pool->next_out++;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->out_lock);
+}
+
+static void* worker_run(void* arg) {
+    worker_t* w = arg;
+    pool_t* pool = w->pool;
+    ysh_t* sh = w->sh;
+
+    while (!deadline_expired(&sh->deadline)) {
+        size_t idx;
+        char* item = next_item(pool, &idx);
+        if (!item)
+            break;
+
+        ysh_child_reset(pool->sh, sh);
+        var_set(&sh->vars, pool->name, item);
+        free_trap(item);
+
+        char* out = NULL;
+        cmd_io_t io = { pool->item_in, pool->io->out, &out };
+        ast_t* cmd = resolve(sh, pool->body);
+        int status = execute(sh, cmd, &io);
+        ast_free(cmd);
+
+        item_done(pool, idx, out, status);
+    }
+
+#ifdef __linux__
+    // What this thread used itself goes to the map, the same as a child
+    // it reaped. Elsewhere there's no telling it apart from the rest of
+    // the process, so the map's own thread's usage will have to do.
+    struct rusage ru;
+    if (w->thread_own && getrusage(RUSAGE_THREAD, &ru) == 0) {
+        cmd_usage_t used;
+        usage_from_rusage(&used, &ru);
+        usage_add(&sh->spent, &used);
+    }
+#endif
+
+    return NULL;
+}
+
+// Words in args, to avoid starting workers with nothing to do.
+static size_t count_words(char** args) {
+    size_t count = 0;
+    for (; *args; args++) {
+        for (char* at = *args; *at; ) {
+            while (isspace(*at))
+                at++;
+            if (!*at)
+                break;
+            count++;
+            while (*at && !isspace(*at))
+                at++;
+        }
+    }
+    return count;
+}
+
+// map [-j jobs] [-k] name body [item ...]
+// each [-j jobs] name body [item ...]
+//   Runs body once for each item with $name set to it, up to jobs
+//   (default: one per CPU) at a time. Items are split on whitespace; with
+//   none given, each line of input is an item. each, and map -k, write
+//   output in the order of the items rather than as they finish.
+int builtin_map(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t jobs = ncpu > 0 ? ncpu : 1;
+    int ordered = nam[0] == 'e';
+
+    size_t idx = 1;
+    for (; argv[idx] && argv[idx][0] == '-'; idx++) {
+        if (!strcmp(argv[idx], "-k")) {
+            ordered = 1;
+        } else if (!strcmp(argv[idx], "-j") && argv[idx+1]) {
+            jobs = strtoul(argv[++idx], NULL, 0);
+        } else {
+            break;
+        }
+    }
+
+    if (!argv[idx] || !argv[idx+1] || !jobs) {
+        dprintf(sh->err, "%s: usage: %s [-j jobs] [-k] name body [item...]\n", nam, nam);
+        return -1;
+    }
+
+    pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.src_lock, NULL);
+    pthread_mutex_init(&pool.out_lock, NULL);
+    pool.sh      = sh;
+    pool.name    = argv[idx];
+    pool.body    = parse(sh, argv[idx+1]);
+    pool.io      = io;
+    pool.ordered = ordered;
+    pool.item_in = io->in;
+
+    if (argv[idx+2]) {
+        pool.args = &argv[idx+2];
+        size_t words = count_words(pool.args);
+        if (words < jobs)
+            jobs = words;
+    } else {
+        // Input is the list of items, so it's not for the items' commands.
+        pool.in_fd = io->in;
+        pool.item_in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    // Children are made here, on the shell's own thread, since they copy
+    // its variables.
+    worker_t* workers = malloc_trap((jobs ? jobs : 1) * sizeof(worker_t));
+    for (size_t i = 0; i < jobs; i++) {
+        workers[i].pool = &pool;
+        workers[i].sh = ysh_child(sh);
+        workers[i].sh->in = pool.item_in;
+    }
+
+    for (size_t i = 0; i < jobs; i++) {
+        // No thread to be had; this worker's share gets done by whichever
+        // others did start, or right here by the first.
+        workers[i].thread_own = 1;
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+            workers[i].thread_own = 0;
+            if (i == 0) {
+                workers[i].sh->threaded = 0;
+                worker_run(&workers[i]);
+            }
+            workers[i].pool = NULL;
+        }
+    }
+
+    for (size_t i = 0; i < jobs; i++) {
+        if (workers[i].pool)
+            pthread_join(workers[i].thread, NULL);
+        ysh_child_join(sh, workers[i].sh);
+    }
+
+    free_trap(workers);
+    if (!pool.args && pool.item_in != -1)
+        close(pool.item_in);
+    free_trap(pool.buf);
+    free_trap(pool.held);
+    free_trap(pool.done);
+    ast_free(pool.body);
+    pthread_mutex_destroy(&pool.src_lock);
+    pthread_mutex_destroy(&pool.out_lock);
+
+    return pool.status;
+}
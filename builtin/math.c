@@ -19,8 +19,9 @@
 
 #include "parse.h"
 #include "util.h"
+#include "shell.h"
 
-int builtin_add(char* nam, char** argv, char** stdout) {
+int builtin_add(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
     assert(nam);
     assert(argv[0]);
 
@@ -29,7 +30,7 @@ int builtin_add(char* nam, char** argv, char** stdout) {
     for(size_t idx = 1; argv[idx] != 0; idx++) {
         long long int ret = strtoll(argv[idx], NULL, 0);
         if ((ret == LLONG_MIN || ret == LLONG_MAX) && errno) {
-            perror("builtin: add");
+            dprintf(sh->err, "%s: %s: %s\n", nam, argv[idx], strerror(errno));
             return -1;
         }
         total += ret;
@@ -53,16 +54,17 @@ int builtin_add(char* nam, char** argv, char** stdout) {
             break;
     }
 
-    if (stdout) {
-        *stdout = str;
+    if (io->capture) {
+        *io->capture = str;
     } else {
-        printf("%s\n", str);
+        dprintf(io->out, "%s\n", str);
+        free_trap(str);
     }
 
     return 0;
 }
 
-int builtin_sub(char* nam, char** argv, char** stdout) {
+int builtin_sub(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
     assert(nam);
     assert(argv[0]);
 
@@ -71,7 +73,7 @@ int builtin_sub(char* nam, char** argv, char** stdout) {
     for(size_t idx = 1; argv[idx] != 0; idx++) {
         long long int ret = strtoll(argv[idx], NULL, 0);
         if ((ret == LLONG_MIN || ret == LLONG_MAX) && errno) {
-            perror("builtin: add");
+            dprintf(sh->err, "%s: %s: %s\n", nam, argv[idx], strerror(errno));
             return -1;
         }
         if (idx == 1) {
@@ -99,16 +101,17 @@ int builtin_sub(char* nam, char** argv, char** stdout) {
             break;
     }
 
-    if (stdout) {
-        *stdout = str;
+    if (io->capture) {
+        *io->capture = str;
     } else {
-        printf("%s\n", str);
+        dprintf(io->out, "%s\n", str);
+        free_trap(str);
     }
 
     return 0;
 }
 
-int builtin_mul(char* nam, char** argv, char** stdout) {
+int builtin_mul(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
     assert(nam);
     assert(argv[0]);
 
@@ -117,7 +120,7 @@ int builtin_mul(char* nam, char** argv, char** stdout) {
     for(size_t idx = 1; argv[idx] != 0; idx++) {
         long long int ret = strtoll(argv[idx], NULL, 0);
         if ((ret == LLONG_MIN || ret == LLONG_MAX) && errno) {
-            perror("builtin: add");
+            dprintf(sh->err, "%s: %s: %s\n", nam, argv[idx], strerror(errno));
             return -1;
         }
         total *= ret;
@@ -141,16 +144,17 @@ int builtin_mul(char* nam, char** argv, char** stdout) {
             break;
     }
 
-    if (stdout) {
-        *stdout = str;
+    if (io->capture) {
+        *io->capture = str;
     } else {
-        printf("%s\n", str);
+        dprintf(io->out, "%s\n", str);
+        free_trap(str);
     }
 
     return 0;
 }
 
-int builtin_div(char* nam, char** argv, char** stdout) {
+int builtin_div(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
     assert(nam);
     assert(argv[0]);
 
@@ -159,7 +163,7 @@ int builtin_div(char* nam, char** argv, char** stdout) {
     for(size_t idx = 1; argv[idx] != 0; idx++) {
         long long int ret = strtoll(argv[idx], NULL, 0);
         if ((ret == LLONG_MIN || ret == LLONG_MAX) && errno) {
-            perror("builtin: add");
+            dprintf(sh->err, "%s: %s: %s\n", nam, argv[idx], strerror(errno));
             return -1;
         }
         if (idx == 1) {
@@ -187,16 +191,17 @@ int builtin_div(char* nam, char** argv, char** stdout) {
             break;
     }
 
-    if (stdout) {
-        *stdout = str;
+    if (io->capture) {
+        *io->capture = str;
     } else {
-        printf("%s\n", str);
+        dprintf(io->out, "%s\n", str);
+        free_trap(str);
     }
 
     return 0;
 }
 
-int builtin_modulo(char* nam, char** argv, char** stdout) {
+int builtin_modulo(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
     assert(nam);
     assert(argv[0]);
 
@@ -205,7 +210,7 @@ int builtin_modulo(char* nam, char** argv, char** stdout) {
     for(size_t idx = 1; argv[idx] != 0; idx++) {
         long long int ret = strtoll(argv[idx], NULL, 0);
         if ((ret == LLONG_MIN || ret == LLONG_MAX) && errno) {
-            perror("builtin: add");
+            dprintf(sh->err, "%s: %s: %s\n", nam, argv[idx], strerror(errno));
             return -1;
         }
         if (idx == 1) {
@@ -233,10 +238,11 @@ int builtin_modulo(char* nam, char** argv, char** stdout) {
             break;
     }
 
-    if (stdout) {
-        *stdout = str;
+    if (io->capture) {
+        *io->capture = str;
     } else {
-        printf("%s\n", str);
+        dprintf(io->out, "%s\n", str);
+        free_trap(str);
     }
 
     return 0;
@@ -0,0 +1,160 @@
+// Subcommands like {hostname} or {git rev-parse HEAD} tend to be repeated
+// on line after line, and each one is a fork and exec. memo runs such a
+// command once and then hands back what it printed, for as long as it's
+// asked for with the same arguments, from the same directory, with the
+// same environment.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+#include "memo.h"
+
+// Leads every key. The directory is identified by device and inode rather
+// than by path, so it's the same after `cd .` and different after the
+// directory is replaced. Any change to the environment at all gives a new
+// generation; working out which variables a command cares about isn't
+// something we can do.
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t env_gen;
+} memo_scope_t;
+
+// Builds the key for running argv in sh: the scope, then each argument
+// with its terminator.
+static char* memo_key(ysh_t* sh, char** argv, size_t* len) {
+    struct stat st;
+    int ret = sh->cwd == AT_FDCWD ? stat(".", &st) : fstat(sh->cwd, &st);
+    if (ret == -1)
+        memset(&st, 0, sizeof(st));
+
+    memo_scope_t scope = { st.st_dev, st.st_ino, sh->vars.env_gen };
+
+    size_t sz = sizeof(scope);
+    for (size_t i = 0; argv[i]; i++)
+        sz += strlen(argv[i]) + 1;
+
+    char* key = malloc_trap(sz);
+    memcpy(key, &scope, sizeof(scope));
+    size_t at = sizeof(scope);
+    for (size_t i = 0; argv[i]; i++) {
+        size_t arg_len = strlen(argv[i]) + 1;
+        memcpy(&key[at], argv[i], arg_len);
+        at += arg_len;
+    }
+
+    *len = sz;
+    return key;
+}
+
+static void memo_list(memo_t* memo, cmd_io_t* io) {
+    char line[256];
+    uint64_t now = memo_now_us();
+
+    int sz = snprintf(line, sizeof(line), "%8s %10s %8s  %s\n", "hits", "age", "bytes", "command");
+    builtin_output(io, line, sz);
+
+    for (memo_ent_t* ent = memo->list; ent; ent = ent->next) {
+        sz = snprintf(line, sizeof(line), "%8llu %9.1fs %8zu ",
+                      (unsigned long long)ent->hits, (now - ent->stored_us) / 1e6, ent->out_len);
+        builtin_output(io, line, sz);
+
+        // The arguments, NUL-separated after the scope.
+        for (size_t at = sizeof(memo_scope_t); at < ent->key_len; ) {
+            size_t arg_len = strlen(&ent->key[at]);
+            builtin_output(io, " ", 1);
+            builtin_output(io, &ent->key[at], arg_len);
+            at += arg_len + 1;
+        }
+        builtin_output(io, "\n", 1);
+    }
+}
+
+// Hands back output as captured, the same way for a fresh run as for a
+// remembered one. Capturing took off the last '\n', and run_command takes
+// it off again for a subcommand.
+static void memo_output(cmd_io_t* io, const char* out, size_t len) {
+    if (len) {
+        builtin_output(io, out, len);
+        builtin_output(io, "\n", 1);
+    }
+}
+
+// memo [-t secs] command [args...]
+//   Prints command's output from the last time it was run this way, or
+//   runs it and remembers the output if it succeeded.
+// memo -c
+//   Forget everything.
+// memo
+//   List what's remembered.
+int builtin_memo(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1]) {
+        memo_list(&sh->memo, io);
+        return 0;
+    }
+
+    if (!strcmp(argv[1], "-c")) {
+        memo_clear(&sh->memo);
+        return 0;
+    }
+
+    size_t cmd = 1;
+    uint64_t max_age = 0;
+    if (!strcmp(argv[1], "-t")) {
+        if (!argv[2] || !argv[3]) {
+            dprintf(sh->err, "memo: usage: memo [-t secs] command [args...]\n");
+            return -1;
+        }
+        double secs = strtod(argv[2], NULL);
+        if (secs <= 0) {
+            dprintf(sh->err, "memo: %s is not a valid age\n", argv[2]);
+            return -1;
+        }
+        max_age = secs * 1000000;
+        cmd = 3;
+    }
+
+    // What's in redirected input can't be part of the key (it may not
+    // even be a file), so with it there's nothing to remember by.
+    if (io->in != sh->in)
+        return run_wrapped(sh, &argv[cmd], io, NULL);
+
+    size_t key_len;
+    char* key = memo_key(sh, &argv[cmd], &key_len);
+
+    memo_ent_t* ent = memo_find(&sh->memo, key, key_len, max_age);
+    if (ent) {
+        memo_output(io, ent->out, ent->out_len);
+        free_trap(key);
+        return 0;
+    }
+
+    char* out = NULL;
+    cmd_io_t sub = *io;
+    sub.capture = &out;
+    int status = run_command(sh, &argv[cmd], &sub, NULL);
+
+    size_t len = out ? strlen(out) : 0;
+    memo_output(io, out ? out : "", len);
+
+    // Failures are never remembered; they're as likely as not to be
+    // something temporary, and are worth running again.
+    if (status == 0)
+        memo_store(&sh->memo, key, key_len, out ? out : "", len);
+
+    free_trap(out);
+    free_trap(key);
+    return status;
+}
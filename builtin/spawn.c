@@ -1 +1,43 @@
 // Future home of the background process handling builtins.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+// timeout SECS command [args...]
+//   Runs command, stopping it if it's still going after SECS seconds, which
+//   may be fractional. Exits with 124 if it had to be stopped. Anything it
+//   started is stopped too, unless it was reading from the terminal (see
+//   fork_and_execvp()).
+int builtin_timeout(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1] || !argv[2]) {
+        dprintf(sh->err, "timeout: usage: timeout secs command [args...]\n");
+        return -1;
+    }
+
+    double secs = strtod(argv[1], NULL);
+    if (secs <= 0) {
+        dprintf(sh->err, "timeout: %s is not a valid timeout\n", argv[1]);
+        return -1;
+    }
+
+    uint64_t prev = deadline_narrow(&sh->deadline, secs * 1000000);
+    deadline_hit_clear(&sh->deadline);
+
+    int status = run_wrapped(sh, &argv[2], io, NULL);
+    if (deadline_hit(&sh->deadline))
+        status = DEADLINE_STATUS;
+
+    deadline_restore(&sh->deadline, prev);
+    return status;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+#include "alloc.h"
+
+// time command [args...]
+//   Runs command and reports what it cost on stderr, so that the report
+//   never ends up in a subcommand's output or a redirected file.
+int builtin_time(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1]) {
+        dprintf(sh->err, "time: needs a command\n");
+        return -1;
+    }
+
+    cmd_usage_t u;
+    int status = run_wrapped(sh, &argv[1], io, &u);
+
+    dprintf(sh->err, "real %llu.%06llus  user %llu.%06llus  sys %llu.%06llus\n"
+               "maxrss %ldKB  faults %ld minor / %ld major  "
+               "ctxsw %ld voluntary / %ld involuntary\n",
+            (unsigned long long)u.wall_us / 1000000, (unsigned long long)u.wall_us % 1000000,
+            (unsigned long long)u.user_us / 1000000, (unsigned long long)u.user_us % 1000000,
+            (unsigned long long)u.sys_us / 1000000,  (unsigned long long)u.sys_us % 1000000,
+            u.maxrss_kb, u.minflt, u.majflt, u.nvcsw, u.nivcsw);
+
+    return status;
+}
+
+static void stats_hist(stats_ent_t* ent, cmd_io_t* io) {
+    char line[128];
+    uint64_t most = 0;
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+        if (ent->hist[b] > most)
+            most = ent->hist[b];
+    }
+
+    // Names can be any length, so they're never formatted into line.
+    builtin_output(io, ent->name, strlen(ent->name));
+    int sz = snprintf(line, sizeof(line), ": %llu runs, wall time:\n",
+                      (unsigned long long)ent->count);
+    builtin_output(io, line, sz);
+
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+        if (!ent->hist[b])
+            continue;
+
+        char bar[41];
+        size_t len = (ent->hist[b] * 40 + most - 1) / most;
+        memset(bar, '#', len);
+        bar[len] = 0;
+
+        sz = snprintf(line, sizeof(line), "  < %10lluus %10llu %s\n",
+                      1ull << b, (unsigned long long)ent->hist[b], bar);
+        builtin_output(io, line, sz);
+    }
+}
+
+// stats
+//   Totals for every command name run this session.
+// stats NAME...
+//   Wall time histogram for each NAME.
+// stats -r
+//   Forget everything recorded so far.
+int builtin_stats(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    char line[256];
+    int sz;
+
+    if (argv[1] && !strcmp(argv[1], "-r")) {
+        stats_reset(&sh->stats);
+        return 0;
+    }
+
+    if (argv[1]) {
+        for (size_t idx = 1; argv[idx]; idx++) {
+            stats_ent_t* ent = stats_find(&sh->stats, argv[idx]);
+            if (!ent) {
+                dprintf(sh->err, "stats: %s has not been run\n", argv[idx]);
+                continue;
+            }
+            stats_hist(ent, io);
+        }
+    } else {
+        sz = snprintf(line, sizeof(line), "%-20s %8s %12s %12s %12s %10s %10s %8s %10s %10s\n",
+                      "command", "runs", "real", "user", "sys", "maxrss", "minflt",
+                      "majflt", "vcsw", "ivcsw");
+        builtin_output(io, line, sz);
+
+        for (stats_ent_t* ent = stats_first(&sh->stats); ent; ent = ent->next) {
+            // Names can be any length, so they're never formatted into
+            // line; padded out to the column by hand instead.
+            size_t name_len = strlen(ent->name);
+            builtin_output(io, ent->name, name_len);
+            if (name_len < 20)
+                builtin_output(io, "                    ", 20 - name_len);
+
+            sz = snprintf(line, sizeof(line),
+                          " %8llu %12.6f %12.6f %12.6f %8ldKB %10ld %8ld %10ld %10ld\n",
+                          (unsigned long long)ent->count,
+                          ent->total.wall_us / 1e6, ent->total.user_us / 1e6,
+                          ent->total.sys_us / 1e6, ent->total.maxrss_kb,
+                          ent->total.minflt, ent->total.majflt,
+                          ent->total.nvcsw, ent->total.nivcsw);
+            builtin_output(io, line, sz);
+        }
+    }
+
+    return 0;
+}
+
+// allocs
+//   Allocation counters for the session, by stage (needs ysh -A.)
+// allocs -r
+//   Reset them.
+int builtin_allocs(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!alloc_prof) {
+        dprintf(sh->err, "allocs: allocation accounting is off; run ysh with -A\n");
+        return -1;
+    }
+
+    if (argv[1] && !strcmp(argv[1], "-r")) {
+        alloc_reset();
+        return 0;
+    }
+
+    char buf[2048];
+    int len = alloc_report(buf, sizeof(buf), 1);
+    if (len >= (int)sizeof(buf))
+        len = sizeof(buf) - 1;
+    builtin_output(io, buf, len);
+
+    return 0;
+}
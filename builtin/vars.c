@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+// Joins argv from idx on with spaces, so that `= NAME hello world` works
+// without quoting.
+static char* join_args(char** argv, size_t idx) {
+    size_t len = 1;
+    for (size_t i = idx; argv[i]; i++)
+        len += strlen(argv[i]) + 1;
+
+    char* ret = malloc_trap(len);
+    ret[0] = 0;
+    for (size_t i = idx; argv[i]; i++) {
+        if (i != idx)
+            strcat(ret, " ");
+        strcat(ret, argv[i]);
+    }
+    return ret;
+}
+
+int builtin_set(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1]) {
+        dprintf(sh->err, "=: needs a variable name\n");
+        return -1;
+    }
+
+    char* value = join_args(argv, 2);
+    var_set(&sh->vars, argv[1], value);
+    free_trap(value);
+
+    return 0;
+}
+
+int builtin_export(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    if (!argv[1]) {
+        dprintf(sh->err, "export: needs a variable name\n");
+        return -1;
+    }
+
+    if (argv[2]) {
+        char* value = join_args(argv, 2);
+        var_set(&sh->vars, argv[1], value);
+        free_trap(value);
+    }
+    var_export(&sh->vars, argv[1]);
+
+    return 0;
+}
+
+int builtin_unset(ysh_t* sh, char* nam, char** argv, cmd_io_t* io) {
+    assert(nam);
+    assert(argv[0]);
+
+    for (size_t idx = 1; argv[idx]; idx++)
+        var_unset(&sh->vars, argv[idx]);
+
+    return 0;
+}
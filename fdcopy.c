@@ -0,0 +1,78 @@
+// copy_file_range, sendfile and splice are Linux-only, and glibc hides
+// their prototypes behind _GNU_SOURCE. Everything else falls back to
+// plain read/write.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "parse.h"
+#include "util.h"
+
+#define FD_COPY_CHUNK (1 << 20)
+
+/* Copies everything from in to out until EOF on in, without the data
+ * passing through user space where the kernel allows it:
+ *
+ *   copy_file_range - file to file; may even share extents (reflink).
+ *   sendfile        - file to anything, e.g. a terminal or socket.
+ *   splice          - anything to or from a pipe.
+ *
+ * Each is tried in turn and the next one picks up where the last stopped,
+ * since they all advance the file offsets as they go. Returns 0 or -1.
+ */
+int fd_copy(int in, int out) {
+    ssize_t ret;
+
+#ifdef __linux__
+    while ((ret = copy_file_range(in, NULL, out, NULL, FD_COPY_CHUNK, 0)) > 0 ||
+           (ret == -1 && errno == EINTR))
+        ;
+    if (ret == 0)
+        return 0;
+
+    while ((ret = sendfile(out, in, NULL, FD_COPY_CHUNK)) > 0 ||
+           (ret == -1 && errno == EINTR))
+        ;
+    if (ret == 0)
+        return 0;
+
+    while ((ret = splice(in, NULL, out, NULL, FD_COPY_CHUNK, SPLICE_F_MOVE)) > 0 ||
+           (ret == -1 && errno == EINTR))
+        ;
+    if (ret == 0)
+        return 0;
+#endif
+
+    char buf[65536];
+    while ((ret = read(in, buf, sizeof(buf))) != 0) {
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        char* at = buf;
+        while (ret) {
+            ssize_t wr = write(out, at, ret);
+            if (wr == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            at  += wr;
+            ret -= wr;
+        }
+    }
+
+    return 0;
+}
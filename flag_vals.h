@@ -1,6 +0,0 @@
-#ifndef FLAG_VALS_H
-#define FLAG_VALS_H
-
-extern int obscene_debug;
-
-#endif
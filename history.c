@@ -0,0 +1,523 @@
+// glibc only declares memmem with _GNU_SOURCE.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "parse.h"
+#include "util.h"
+#include "history.h"
+
+// Layout of the history file is as dumb as possible; every entry is the
+// line as typed followed by a NUL. There is no header, so any number of
+// shells can append to it at once with O_APPEND and never need to agree
+// on anything other than "one write() per entry".
+//
+// Searching goes through a trigram index: for each bucket of trigrams, the
+// list of blocks of HIST_BLOCK entries where one appears. A search takes
+// the needle's trigram with the shortest list and only looks at those
+// blocks, newest first, so the cost depends on how common the needle's
+// rarest trigram is rather than how long the history is. A block is
+// looked at with memmem over its bytes, which are all together in the
+// file, rather than entry by entry.
+//
+// The index lives in "<history>.idx", as segments which each cover the
+// next HIST_SEG entries and are never changed once written. A segment has
+// where each of its blocks starts, so entries in it are found without
+// walking the history, and per bucket the blocks (by number in the
+// segment) in ascending order. Segments are appended under flock() by
+// whichever shell first sees the entries for one, and read back through a
+// mapping; nothing is read at startup. The tail, the entries after the
+// last segment, is never more than HIST_SEG entries, and only has where
+// each entry starts kept in memory; searches just look at all of it. So
+// the history is only indexed once, by the first shell to use it, rather
+// than by every shell, and a shell never holds more than a segment's
+// worth of index.
+//
+// The index file is a cache of the history file, and in host byte order.
+// A segment which doesn't fit the history file (say the history was
+// truncated, or replaced) ends it, and is written over with a new one. An
+// edit in place which keeps every entry boundary isn't noticed, but that
+// only loses matches, as every block is checked with memmem anyway.
+
+typedef struct hist_seg_s {
+    uint32_t magic;
+    uint32_t size;        // Of the whole segment, this header included.
+    uint64_t start, end;  // The bytes of the history file it covers.
+    uint64_t check;       // See seg_check().
+    uint64_t blk_off[HIST_SEG_BLOCKS];
+    uint32_t bucket[HIST_BUCKETS];  // Where each bucket's list ends.
+    uint16_t blks[];
+} hist_seg_t;
+
+#define HIST_SEG_MAGIC 0x59534831u  // "YSH1"
+
+// Knuth's multiplicative hash of a trigram; top bits are the good ones.
+static uint32_t tri_hash(const char* str) {
+    uint32_t h = ((uint8_t)str[0] << 16) | ((uint8_t)str[1] << 8) | (uint8_t)str[2];
+    return h * 2654435761u;
+}
+
+static size_t tri_bucket(uint32_t h) {
+    return h >> (32 - HIST_BUCKET_BITS);
+}
+
+// FNV-1a over the entries at either end of [start, end), starting from
+// the history file's inode; editors and the like replace a file rather
+// than write over it.
+static uint64_t seg_check(hist_t* hist, uint64_t start, uint64_t end) {
+    const char* map = hist->map;
+    uint64_t last = end - 1;
+    while (last > start && map[last - 1] != 0)
+        last--;
+
+    uint64_t h = 14695981039346656037u ^ hist->ino;
+    for (const char* str = &map[start]; *str; str++)
+        h = (h ^ (uint8_t)*str) * 1099511628211u;
+    for (const char* str = &map[last]; *str; str++)
+        h = (h ^ (uint8_t)*str) * 1099511628211u;
+    return h;
+}
+
+// Whether seg, with 'room' bytes of the index file from its start, is a
+// good segment following on from byte 'start' of the history file.
+static int seg_valid(hist_t* hist, const hist_seg_t* seg, size_t room, uint64_t start) {
+    if (seg->magic != HIST_SEG_MAGIC || seg->size % 8 != 0 ||
+        seg->size < sizeof(hist_seg_t) || seg->size > room)
+        return 0;
+    if (seg->start != start || seg->end <= start || seg->end > hist->map_sz ||
+        hist->map[seg->end - 1] != 0)
+        return 0;
+    if (seg->blk_off[0] != start)
+        return 0;
+    for (size_t i = 1; i < HIST_SEG_BLOCKS; i++) {
+        if (seg->blk_off[i] <= seg->blk_off[i - 1] || seg->blk_off[i] >= seg->end)
+            return 0;
+    }
+    return seg->check == seg_check(hist, seg->start, seg->end);
+}
+
+static void posts_free(hist_post_t* posts) {
+    if (!posts)
+        return;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        free_trap(posts[i].blks);
+    free_trap(posts);
+}
+
+// Forgets the tail, which then starts again at byte 'at'.
+static void tail_reset(hist_t* hist, uint64_t at) {
+    hist->n = 0;
+    hist->walked = at;
+    hist->get_off = 0;
+}
+
+static void seg_push(hist_t* hist, const hist_seg_t* seg) {
+    if (hist->nseg == hist->seg_cap) {
+        hist->seg_cap = hist->seg_cap ? hist->seg_cap * 2 : 16;
+        hist->seg = realloc_trap(hist->seg, hist->seg_cap * sizeof(hist_seg_t*));
+    }
+    hist->seg[hist->nseg++] = seg;
+}
+
+// Maps the index file again if it has changed size (or if 'force'), and
+// finds how many of its segments are good. If that number changed, so did
+// where the tail starts.
+static void idx_refresh(hist_t* hist, int force) {
+    struct stat st;
+
+    if (hist->idx_fd == -1 || fstat(hist->idx_fd, &st) == -1)
+        return;
+
+    size_t size = st.st_size;
+    if (size == hist->idx_sz && !force)
+        return;
+
+    if (hist->idx_map)
+        munmap(hist->idx_map, hist->idx_sz);
+    hist->idx_map = NULL;
+    hist->idx_sz = 0;
+    if (size) {
+        hist->idx_map = mmap(NULL, size, PROT_READ, MAP_SHARED, hist->idx_fd, 0);
+        if (hist->idx_map == MAP_FAILED) {
+            perror("history: mmap");
+            hist->idx_map = NULL;
+        } else {
+            hist->idx_sz = size;
+        }
+    }
+
+    size_t had = hist->nseg;
+    size_t at = 0;
+    uint64_t end = 0;
+    hist->nseg = 0;
+    while (at + sizeof(hist_seg_t) <= hist->idx_sz) {
+        const hist_seg_t* seg = (const hist_seg_t*)&hist->idx_map[at];
+        if (!seg_valid(hist, seg, hist->idx_sz - at, end))
+            break;
+        seg_push(hist, seg);
+        end = seg->end;
+        at += seg->size;
+    }
+    hist->idx_valid = at;
+
+    if (hist->nseg != had)
+        tail_reset(hist, end);
+}
+
+// Gives up on the index file, after copying the segments in it.
+static void idx_drop(hist_t* hist) {
+    for (size_t i = 0; i < hist->nseg; i++) {
+        hist_seg_t* seg = malloc_trap(hist->seg[i]->size);
+        memcpy(seg, hist->seg[i], hist->seg[i]->size);
+        hist->seg[i] = seg;
+    }
+    if (hist->idx_map)
+        munmap(hist->idx_map, hist->idx_sz);
+    close(hist->idx_fd);
+    hist->idx_fd = -1;
+    hist->idx_map = NULL;
+    hist->idx_sz = hist->idx_valid = 0;
+}
+
+// Adds tail entry id's block to the lists in posts.
+static void index_entry(hist_t* hist, size_t id, hist_post_t* posts) {
+    const char* str = &hist->map[hist->off[id]];
+    uint16_t blk = id / HIST_BLOCK;
+    size_t len = strlen(str);
+
+    for (size_t i = 0; i + 2 < len; i++) {
+        // Entries are added in order, so if the block is already on the
+        // list it's the last thing there.
+        hist_post_t* post = &posts[tri_bucket(tri_hash(&str[i]))];
+        if (post->len && post->blks[post->len - 1] == blk)
+            continue;
+        if (post->len == post->cap) {
+            post->cap = post->cap ? post->cap * 2 : 4;
+            post->blks = realloc_trap(post->blks, post->cap * sizeof(uint16_t));
+        }
+        post->blks[post->len++] = blk;
+    }
+}
+
+// Turns the tail, which is exactly HIST_SEG entries, into a segment.
+static void seg_flush(hist_t* hist) {
+    assert(hist->n == HIST_SEG);
+
+    hist_post_t* posts = malloc_trap(HIST_BUCKETS * sizeof(hist_post_t));
+    memset(posts, 0, HIST_BUCKETS * sizeof(hist_post_t));
+    for (size_t id = 0; id < HIST_SEG; id++)
+        index_entry(hist, id, posts);
+
+    size_t total = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; b++)
+        total += posts[b].len;
+    size_t size = (sizeof(hist_seg_t) + total * sizeof(uint16_t) + 7) & ~(size_t)7;
+
+    hist_seg_t* seg = malloc_trap(size);
+    memset(seg, 0, size);
+    seg->magic = HIST_SEG_MAGIC;
+    seg->size = size;
+    seg->start = hist->off[0];
+    seg->end = hist->walked;
+    seg->check = seg_check(hist, seg->start, seg->end);
+    for (size_t i = 0; i < HIST_SEG_BLOCKS; i++)
+        seg->blk_off[i] = hist->off[i * HIST_BLOCK];
+    size_t at = 0;
+    for (size_t b = 0; b < HIST_BUCKETS; b++) {
+        memcpy(&seg->blks[at], posts[b].blks, posts[b].len * sizeof(uint16_t));
+        at += posts[b].len;
+        seg->bucket[b] = at;
+    }
+    posts_free(posts);
+
+    if (hist->idx_fd != -1) {
+        flock(hist->idx_fd, LOCK_EX);
+        size_t had = hist->nseg;
+        idx_refresh(hist, 1);
+        if (hist->nseg != had) {
+            // Another shell wrote this one already, or found the index
+            // file stale and started it again; either way the tail moved.
+            flock(hist->idx_fd, LOCK_UN);
+            free_trap(seg);
+            return;
+        }
+
+        if (hist->idx_valid < hist->idx_sz && ftruncate(hist->idx_fd, hist->idx_valid) == -1)
+            perror("history: index");
+        if (write(hist->idx_fd, seg, size) == (ssize_t)size)
+            idx_refresh(hist, 1);
+        if (hist->nseg == had + 1) {
+            flock(hist->idx_fd, LOCK_UN);
+            free_trap(seg);
+            return;
+        }
+
+        // It didn't get written, or didn't read back; carry on without.
+        fprintf(stderr, "history: can't update the index file\n");
+        if (ftruncate(hist->idx_fd, hist->idx_valid) == -1)
+            perror("history: index");
+        idx_drop(hist);
+    }
+
+    seg_push(hist, seg);
+    tail_reset(hist, seg->end);
+}
+
+static void history_sync(hist_t* hist) {
+    struct stat st;
+
+    if (hist->fd == -1 || fstat(hist->fd, &st) == -1)
+        return;
+
+    size_t size = st.st_size;
+    if (size > hist->map_sz) {
+        // Someone (possibly us) appended; map the whole thing again.
+        // mremap would be nicer, but it's a Linux-ism.
+        if (hist->map)
+            munmap(hist->map, hist->map_sz);
+        hist->map = mmap(NULL, size, PROT_READ, MAP_SHARED, hist->fd, 0);
+        if (hist->map == MAP_FAILED) {
+            perror("history: mmap");
+            hist->map = NULL;
+            hist->map_sz = 0;
+            return;
+        }
+        hist->map_sz = size;
+    }
+    if (size > hist->map_sz)
+        size = hist->map_sz;
+
+    // New segments only ever cover entries which were appended, so with
+    // nothing new there's no need to look at the index file either.
+    if (size <= hist->walked)
+        return;
+
+    idx_refresh(hist, 0);
+
+    for (;;) {
+        if (hist->n == HIST_SEG) {
+            seg_flush(hist);
+            continue;
+        }
+
+        // An entry still being written by another shell has no NUL yet;
+        // leave it for the next sync.
+        size_t at = hist->walked;
+        char* end = at < size ? memchr(&hist->map[at], 0, size - at) : NULL;
+        if (!end)
+            break;
+
+        if (hist->n == hist->cap) {
+            hist->cap = hist->cap ? hist->cap * 2 : 1024;
+            hist->off = realloc_trap(hist->off, hist->cap * sizeof(uint64_t));
+        }
+        hist->off[hist->n++] = at;
+        hist->walked = end - hist->map + 1;
+    }
+}
+
+// Where entry idx starts. Entries in a segment are found from the start
+// of their block, or from the last one looked up if that's closer.
+static uint64_t entry_off(hist_t* hist, size_t idx) {
+    size_t in_segs = hist->nseg * HIST_SEG;
+    if (idx >= in_segs)
+        return hist->off[idx - in_segs];
+
+    const hist_seg_t* seg = hist->seg[idx / HIST_SEG];
+    uint64_t off = seg->blk_off[idx % HIST_SEG / HIST_BLOCK];
+    size_t at = idx - idx % HIST_BLOCK;
+    if (hist->get_off && hist->get_idx <= idx && hist->get_idx > at) {
+        off = hist->get_off;
+        at = hist->get_idx;
+    }
+    for (; at < idx; at++)
+        off += strlen(&hist->map[off]) + 1;
+
+    hist->get_idx = idx;
+    hist->get_off = off;
+    return off;
+}
+
+// The newest match older than 'before' in block blk.
+static long block_search(hist_t* hist, size_t blk, const char* needle, size_t len, size_t before) {
+    size_t from = blk * HIST_BLOCK;
+    size_t to = from + HIST_BLOCK;
+    if (to > before)
+        to = before;
+
+    // A needle has no NUL in it, so can't match across entries, and the
+    // last match in the block's bytes is in the newest entry with one.
+    uint64_t start = entry_off(hist, from);
+    uint64_t end = to < hist->nseg * HIST_SEG + hist->n ? entry_off(hist, to) : hist->walked;
+    const char* hay = &hist->map[start];
+    const char* last = NULL;
+    for (const char* at = hay; (at = memmem(at, &hist->map[end] - at, needle, len)); at++)
+        last = at;
+    if (!last)
+        return -1;
+
+    long found = from;
+    for (const char* at = hay; (at = memchr(at, 0, last - at)); at++)
+        found++;
+    return found;
+}
+
+void history_init(hist_t* hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->fd = -1;
+    hist->idx_fd = -1;
+}
+
+int history_open(hist_t* hist, const char* path) {
+    assert(path);
+
+    history_close(hist);
+
+    hist->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist->fd == -1) {
+        perror("history");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(hist->fd, &st) == 0)
+        hist->ino = st.st_ino;
+
+    // Without the index file, searches still work, but every shell has
+    // to index the whole history for itself.
+    size_t len = strlen(path) + sizeof(".idx");
+    char* idx_path = malloc_trap(len);
+    snprintf(idx_path, len, "%s.idx", path);
+    hist->idx_fd = open(idx_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    free_trap(idx_path);
+
+    return 0;
+}
+
+void history_close(hist_t* hist) {
+    if (hist->map)
+        munmap(hist->map, hist->map_sz);
+    if (hist->fd != -1)
+        close(hist->fd);
+
+    if (hist->idx_fd == -1) {
+        for (size_t i = 0; i < hist->nseg; i++)
+            free_trap((void*)hist->seg[i]);
+    } else {
+        if (hist->idx_map)
+            munmap(hist->idx_map, hist->idx_sz);
+        close(hist->idx_fd);
+    }
+    free_trap(hist->seg);
+
+    free_trap(hist->off);
+
+    history_init(hist);
+}
+
+void history_add(hist_t* hist, const char* line) {
+    assert(line);
+
+    if (hist->fd == -1 || line[0] == 0)
+        return;
+
+    // The trailing NUL goes out in the same write() as the line, so other
+    // shells see either all of an entry or none of it. The lock is only
+    // there for filesystems where O_APPEND is less than atomic.
+    size_t len = strlen(line) + 1;
+    flock(hist->fd, LOCK_EX);
+    if (write(hist->fd, line, len) != (ssize_t)len)
+        perror("history: write");
+    flock(hist->fd, LOCK_UN);
+}
+
+size_t history_count(hist_t* hist) {
+    history_sync(hist);
+    return hist->nseg * HIST_SEG + hist->n;
+}
+
+/* Returns entry idx (0 is the oldest.) The pointer is into the mapping,
+ * and is only valid until the next call into the history code.
+ */
+const char* history_get(hist_t* hist, size_t idx) {
+    if (idx >= history_count(hist))
+        return NULL;
+    return &hist->map[entry_off(hist, idx)];
+}
+
+/* Searches backwards for the newest entry containing needle which is older
+ * than entry 'before'. Returns the index, or -1 if nothing matched. Passing
+ * the previous result as 'before' gives the next older match, which is
+ * exactly what repeated Ctrl-R does.
+ */
+long history_search(hist_t* hist, const char* needle, size_t before) {
+    assert(needle);
+
+    size_t count = history_count(hist);
+    if (before > count)
+        before = count;
+
+    size_t len = strlen(needle);
+    if (len < 3) {
+        // Too short to have a trigram, so there's nothing to look up.
+        for (size_t blk = (before + HIST_BLOCK - 1) / HIST_BLOCK; blk-- > 0; ) {
+            long found = block_search(hist, blk, needle, len, before);
+            if (found != -1)
+                return found;
+        }
+        return -1;
+    }
+
+    // The tail isn't indexed, so every block of it.
+    size_t in_segs = hist->nseg * HIST_SEG;
+    for (size_t blk = (before + HIST_BLOCK - 1) / HIST_BLOCK; blk-- > in_segs / HIST_BLOCK; ) {
+        long found = block_search(hist, blk, needle, len, before);
+        if (found != -1)
+            return found;
+    }
+
+    // Then each segment, newest first, with whichever of the needle's
+    // buckets is shortest in that one.
+    for (size_t s = hist->nseg; s-- > 0; ) {
+        if (s * HIST_SEG >= before)
+            continue;
+
+        const hist_seg_t* seg = hist->seg[s];
+        size_t total = (seg->size - sizeof(hist_seg_t)) / sizeof(uint16_t);
+        size_t lo = 0, hi = SIZE_MAX;
+        for (size_t i = 0; i + 2 < len; i++) {
+            size_t b = tri_bucket(tri_hash(&needle[i]));
+            size_t b_lo = b ? seg->bucket[b - 1] : 0;
+            size_t b_hi = seg->bucket[b];
+            if (b_hi - b_lo < hi - lo) {
+                lo = b_lo;
+                hi = b_hi;
+            }
+        }
+        if (hi > total || lo > hi)
+            continue;
+
+        for (size_t i = hi; i-- > lo; ) {
+            if (seg->blks[i] >= HIST_SEG_BLOCKS)
+                continue;
+            size_t blk = s * HIST_SEG_BLOCKS + seg->blks[i];
+            if (blk * HIST_BLOCK >= before)
+                continue;
+            long found = block_search(hist, blk, needle, len, before);
+            if (found != -1)
+                return found;
+        }
+    }
+
+    return -1;
+}
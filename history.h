@@ -0,0 +1,63 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// The history file is an append-only log of NUL-terminated entries which
+// may be shared by any number of concurrently running shells. It is mapped
+// into memory rather than read. Its search index is kept in a file of its
+// own next to it, so it only ever has to be built once.
+
+#include <stdint.h>
+
+// Blocks of a segment being built which contain a trigram (or rather, one
+// of the trigrams which hash to the same bucket.)
+typedef struct {
+    uint16_t* blks;
+    uint32_t  len, cap;
+} hist_post_t;
+
+#define HIST_BUCKET_BITS 14
+#define HIST_BUCKETS    (1 << HIST_BUCKET_BITS)
+#define HIST_BLOCK      64    // Entries per block.
+#define HIST_SEG_BLOCKS 1024  // Blocks per segment of the index file.
+#define HIST_SEG        (HIST_BLOCK * HIST_SEG_BLOCKS)
+
+struct hist_seg_s;
+
+// One interpreter's view of a history file. Use history_init() before
+// anything else.
+typedef struct {
+    int          fd;
+    uint64_t     ino;
+    char*        map;
+    size_t       map_sz;
+    size_t       walked;   // Bytes of the file already walked.
+
+    // The index file, and the segments in it which are still good. Each
+    // covers HIST_SEG entries, from entry 0 onwards. If the index file
+    // can't be used (idx_fd == -1) the segments are on the heap instead.
+    int          idx_fd;
+    char*        idx_map;
+    size_t       idx_sz, idx_valid;
+    const struct hist_seg_s** seg;
+    size_t       nseg, seg_cap;
+
+    // The tail, which is every entry after the last segment, and where
+    // each one starts.
+    uint64_t*    off;
+    size_t       n, cap;
+
+    // The last entry looked up in a segment, as history_get() is mostly
+    // called for consecutive entries.
+    size_t       get_idx;
+    uint64_t     get_off;
+} hist_t;
+
+void history_init(hist_t* hist);
+int history_open(hist_t* hist, const char* path);
+void history_close(hist_t* hist);
+void history_add(hist_t* hist, const char* line);
+size_t history_count(hist_t* hist);
+const char* history_get(hist_t* hist, size_t idx);
+long history_search(hist_t* hist, const char* needle, size_t before);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "memo.h"
+
+// Same shape as the stats list: a handful of entries, with whatever was
+// used last moved to the front. That makes the tail the least recently
+// used entry, which is the one to drop when the memo is full. Each entry
+// carries a hash of its key so the walk only compares keys which are
+// almost certainly equal.
+
+uint64_t memo_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t memo_hash(const char* key, size_t len) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static void memo_ent_free(memo_t* memo, memo_ent_t* ent) {
+    memo->count--;
+    memo->bytes -= ent->key_len + ent->out_len;
+    free_trap(ent->key);
+    free_trap(ent->out);
+    free_trap(ent);
+}
+
+// Unlinks and returns the entry for key, or NULL.
+static memo_ent_t* memo_take(memo_t* memo, const char* key, size_t key_len) {
+    uint64_t hash = memo_hash(key, key_len);
+
+    for (memo_ent_t** at = &memo->list; *at; at = &(*at)->next) {
+        memo_ent_t* ent = *at;
+        if (ent->hash == hash && ent->key_len == key_len &&
+            !memcmp(ent->key, key, key_len)) {
+            *at = ent->next;
+            return ent;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the entry for key if there is one no older than max_age_us (0
+ * for any age), and makes it the most recently used. Entries which are
+ * too old are dropped.
+ */
+memo_ent_t* memo_find(memo_t* memo, const char* key, size_t key_len, uint64_t max_age_us) {
+    assert(key);
+
+    memo_ent_t* ent = memo_take(memo, key, key_len);
+    if (!ent)
+        return NULL;
+
+    if (max_age_us && memo_now_us() - ent->stored_us > max_age_us) {
+        memo_ent_free(memo, ent);
+        return NULL;
+    }
+
+    ent->next = memo->list;
+    memo->list = ent;
+    ent->hits++;
+    return ent;
+}
+
+void memo_store(memo_t* memo, const char* key, size_t key_len, const char* out, size_t out_len) {
+    assert(key && out);
+
+    memo_ent_t* old = memo_take(memo, key, key_len);
+    if (old)
+        memo_ent_free(memo, old);
+
+    if (key_len + out_len > MEMO_MAX_OUT)
+        return;
+
+    memo_ent_t* ent = malloc_trap(sizeof(memo_ent_t));
+    ent->hash    = memo_hash(key, key_len);
+    ent->key     = malloc_trap(key_len);
+    ent->key_len = key_len;
+    ent->out     = malloc_trap(out_len + 1);
+    ent->out_len = out_len;
+    ent->stored_us = memo_now_us();
+    ent->hits    = 0;
+    memcpy(ent->key, key, key_len);
+    memcpy(ent->out, out, out_len);
+    ent->out[out_len] = 0;
+
+    ent->next = memo->list;
+    memo->list = ent;
+    memo->count++;
+    memo->bytes += key_len + out_len;
+
+    // Drop from the tail until we're back within bounds. The new entry
+    // is at the head and always fits, so it's never dropped itself.
+    while (memo->count > MEMO_MAX_ENTRIES || memo->bytes > MEMO_MAX_BYTES) {
+        memo_ent_t** at = &memo->list;
+        while ((*at)->next)
+            at = &(*at)->next;
+        memo_ent_t* last = *at;
+        *at = NULL;
+        memo_ent_free(memo, last);
+    }
+}
+
+void memo_clear(memo_t* memo) {
+    while (memo->list) {
+        memo_ent_t* ent = memo->list;
+        memo->list = ent->next;
+        memo_ent_free(memo, ent);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdint.h>
+
+// Remembered output of commands run through the memo builtin. Keys are
+// opaque byte strings; builtin/memo.c decides what goes into one.
+
+// Bounds on what's kept; the least recently used entries go first once
+// either is passed. An entry bigger than MEMO_MAX_OUT isn't kept at all.
+#define MEMO_MAX_ENTRIES 128
+#define MEMO_MAX_BYTES   (1 << 20)
+#define MEMO_MAX_OUT     (MEMO_MAX_BYTES / 4)
+
+typedef struct memo_ent_s {
+    struct memo_ent_s* next;
+    uint64_t hash;
+    char*    key;
+    size_t   key_len;
+    char*    out;      // Terminated.
+    size_t   out_len;
+    uint64_t stored_us; // CLOCK_MONOTONIC.
+    uint64_t hits;
+} memo_ent_t;
+
+// One interpreter's memo. All zero is empty.
+typedef struct {
+    memo_ent_t* list;  // Most recently used first.
+    size_t      count;
+    size_t      bytes;
+} memo_t;
+
+memo_ent_t* memo_find(memo_t* memo, const char* key, size_t key_len, uint64_t max_age_us);
+void memo_store(memo_t* memo, const char* key, size_t key_len, const char* out, size_t out_len);
+void memo_clear(memo_t* memo);
+uint64_t memo_now_us();
+
+#endif
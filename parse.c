@@ -10,41 +10,60 @@
 
 #include "parse.h"
 #include "util.h"
-#include "flag_vals.h"
+#include "shell.h"
+#include "alloc.h"
 
-void ast_dump_print(ast_t* ast, size_t indent) {
+void ast_dump_print(ysh_t* sh, ast_t* ast, size_t indent) {
     if (ast->type == AST_ROOT) {
         for(size_t i=0; i < indent; i++)
-            printf("  ");
+            dprintf(sh->out, "  ");
 
-        printf("root [%ld]\n", ast->size);
+        dprintf(sh->out, "root [%u]\n", ast->size);
         for(size_t id = 0; id < ast->size; id++) {
-            ast_dump_print(&((ast_t*)ast->ptr)[id], indent+1);
+            ast_dump_print(sh, &ast->kids[id], indent+1);
         }
     } else if (ast->type == AST_GRP) {
         for(size_t i=0; i < indent; i++)
-            printf("  ");
+            dprintf(sh->out, "  ");
 
-        printf("grp [%ld]\n", ast->size);
+        dprintf(sh->out, "grp [%u]\n", ast->size);
         for(size_t id = 0; id < ast->size; id++) {
-            ast_dump_print(&((ast_t*)ast->ptr)[id], indent+1);
+            ast_dump_print(sh, &ast->kids[id], indent+1);
         }
-    } else if (ast->type == AST_STR) {
+    } else if (ast->type == AST_STR || ast->type == AST_LIT) {
+        for(size_t i=0; i < indent; i++)
+            dprintf(sh->out, "  ");
+
+        // Not necessarily terminated; size is what counts.
+        dprintf(sh->out, "%s '%.*s'\n", ast->type == AST_LIT ? "lit" : "str",
+                (int)ast->size, ast_str(ast));
+    } else if (AST_IS_REDIR(ast->type)) {
         for(size_t i=0; i < indent; i++)
-            printf("  ");
-
-        printf("str '");
-        char * str = ast->ptr;
-        size_t max = ast->size;
-        for(size_t s = 0; s < max; s++)
-            printf("%c", str[s]);
-        printf("'\n");
+            dprintf(sh->out, "  ");
+
+        dprintf(sh->out, "redir %s\n", ast->type == AST_REDIR_IN  ? "<" :
+                                        ast->type == AST_REDIR_OUT ? ">" : ">>");
+        ast_dump_print(sh, ast->kids, indent+1);
     } else {
         assert(0);
     }
 }
 
-void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
+// Frees the children of count nodes from split_line (which never own their
+// strings), when the line turns out to be a syntax error.
+static void split_free(ast_t* nodes, size_t count) {
+    for (size_t id = 0; id < count; id++) {
+        if (nodes[id].type == AST_STR || nodes[id].type == AST_LIT)
+            continue;
+        split_free(nodes[id].kids, nodes[id].size);
+        free_trap(nodes[id].kids);
+    }
+}
+
+/* Splits line into *ast, *siz nodes. Returns -1 if it, or anything nested
+ * in it, is a syntax error; *ast is then NULL.
+ */
+int split_line(ysh_t* sh, char* line, size_t len, ast_t** ast, uint32_t* siz, int mode) {
     ast_t *ast_grp = malloc_trap(sizeof(ast_t));
     ast_grp[0].type = AST_UNSET;
     ast_t *group;
@@ -53,6 +72,8 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
     size_t in_q = 0, q_size = 0;
     char *ss_str, *q_str;
     int last = AST_UNSET;
+    int err = 0;
+    size_t op_end = (size_t)-1; // Where a word may start right after a redirection.
     for(size_t i=0; line[i] != 0, i < len; i++) {
         switch(line[i]) {
             case '\'':
@@ -61,14 +82,17 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
                 // nor subshells. Therefore, we'll simply seek to the
                 // next single quote available and insert it as AST_STR.
                 ++i;
-                last = ast_grp[count].type = AST_STR;
-                ast_grp[count].ptr  = &line[i];
+                last = ast_grp[count].type = AST_LIT;
+                ast_grp[count].str  = &line[i];
                 ast_grp[count].size = i; // Temporary save.
                 while(line[i] != '\'' && i < len) {
                     if (line[i] == 0) {
-                        printf("syntax error: unclosed single quote\n");
-                        free(ast_grp);
-                        return;
+                        dprintf(sh->err, "syntax error: unclosed single quote\n");
+                        split_free(ast_grp, count);
+                        free_trap(ast_grp);
+                        *ast = NULL;
+                        *siz = 0;
+                        return -1;
                     }
                     ++i;
                 }
@@ -87,7 +111,8 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
                     in_q = 0; // Quote end.
                     q_size = &line[i-1] - q_str + 1;
 
-                    split_line(q_str, q_size, (ast_t**)&ast_grp[count].ptr, &ast_grp[count].size, 1);
+                    if (split_line(sh, q_str, q_size, &ast_grp[count].kids, &ast_grp[count].size, 1) == -1)
+                        err = 1;
 
                     ++count;
                     ast_grp = realloc_trap(ast_grp, sizeof(ast_t) * (count+1));
@@ -117,7 +142,8 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
 
                         // And now, for something different; we need to run this
                         // function recursively over the subshell string.
-                        split_line(ss_str, ss_size, (ast_t**)&ast_grp[count].ptr, &ast_grp[count].size, 0);
+                        if (split_line(sh, ss_str, ss_size, &ast_grp[count].kids, &ast_grp[count].size, 0) == -1)
+                            err = 1;
 
                         ++count;
                         ast_grp = realloc_trap(ast_grp, sizeof(ast_t) * (count+1));
@@ -132,9 +158,29 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
                 break;
             default:
                 if (ss_count || in_q || mode == 1) break;
-                if ((i && isspace(line[i-1])) || i == 0) {
+                if ((i && isspace(line[i-1])) || i == 0 || i == op_end) {
+                    if (line[i] == '<' || line[i] == '>') {
+                        // Redirection. This only gets a placeholder for now;
+                        // it takes the following element as its target once
+                        // the whole line is split.
+                        if (line[i] == '<') {
+                            last = ast_grp[count].type = AST_REDIR_IN;
+                        } else if (i + 1 < len && line[i+1] == '>') {
+                            last = ast_grp[count].type = AST_REDIR_APP;
+                            ++i;
+                        } else {
+                            last = ast_grp[count].type = AST_REDIR_OUT;
+                        }
+                        ast_grp[count].kids = NULL;
+                        ast_grp[count].size = 0;
+                        ++count;
+                        ast_grp = realloc_trap(ast_grp, sizeof(ast_t) * (count+1));
+                        ast_grp[count].type = AST_UNSET;
+                        op_end = i + 1;
+                        break;
+                    }
                     last = ast_grp[count].type = AST_STR;
-                    ast_grp[count].ptr  = &line[i];
+                    ast_grp[count].str  = &line[i];
                     ast_grp[count].size = i; // Temporary save.
                     while(!isspace(line[i]) && i < len) {
                         if (line[i] == 0) {
@@ -153,7 +199,7 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
         if (mode == 1 && ss_count == 0 && i < len) {
             if (ast_grp[count].type == AST_UNSET) {
                 last = ast_grp[count].type = AST_STR;
-                ast_grp[count].ptr  = &line[i];
+                ast_grp[count].str  = &line[i];
                 ast_grp[count].size = 0; // Temporary save.
             }
             if (ast_grp[count].type == AST_STR) {
@@ -165,78 +211,234 @@ void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode) {
     if (mode == 1 && last == AST_STR) ++count;
 
     if (ss_count)
-        printf("warn: unterminated subshell\n");
+        dprintf(sh->err, "warn: unterminated subshell\n");
+
+    // Copy short strings into their nodes, so that they're terminated and
+    // nothing needs to look at the line again to read them.
+    for (size_t id = 0; id < count; id++) {
+        ast_t* node = &ast_grp[id];
+        node->flags = 0;
+        if ((node->type == AST_STR || node->type == AST_LIT) && node->size <= AST_INLINE_MAX) {
+            char* src = node->str;
+            memcpy(node->inl, src, node->size);
+            node->inl[node->size] = 0;
+            node->flags = AST_F_INLINE;
+        }
+    }
+
+    // Fold each redirection together with its target, so that it is a
+    // single node carrying its own (possibly unresolved) filename.
+    if (mode == 0 && !err) {
+        size_t kept = 0;
+        for (size_t id = 0; id < count; id++) {
+            ast_grp[kept] = ast_grp[id];
+            if (AST_IS_REDIR(ast_grp[id].type)) {
+                if (id + 1 == count || AST_IS_REDIR(ast_grp[id+1].type)) {
+                    dprintf(sh->err, "syntax error: redirection without a target\n");
+                    // Nothing from here on has been moved yet.
+                    split_free(&ast_grp[id], count - id);
+                    err = 1;
+                    break;
+                }
+                ast_t* target = malloc_trap(sizeof(ast_t));
+                *target = ast_grp[++id];
+                ast_grp[kept].kids = target;
+                ast_grp[kept].size = 1;
+            }
+            kept++;
+        }
+        count = kept;
+    }
+
+    if (err) {
+        split_free(ast_grp, count);
+        free_trap(ast_grp);
+        *ast = NULL;
+        *siz = 0;
+        return -1;
+    }
 
     *ast = ast_grp;
     *siz = count;
+    return 0;
 }
 
-ast_t* parse(char* data) {
+ast_t* parse(ysh_t* sh, char* data) {
+    int stage = alloc_stage_enter(ALLOC_SPLIT_LINE);
     ast_t *ast = malloc_trap(sizeof(ast_t));
     ast->type = AST_ROOT;
-    split_line(data, strlen(data), (ast_t**)&ast->ptr, &ast->size, 0);
-
-    ast_t *ptr = ast->ptr;
+    ast->flags = 0;
+    if (split_line(sh, data, strlen(data), &ast->kids, &ast->size, 0) == -1)
+        ast->flags = AST_F_ERROR;
 
-    if (obscene_debug) ast_dump_print(ast, 0);
+    if (sh->debug) ast_dump_print(sh, ast, 0);
 
+    alloc_stage_leave(stage);
     return ast;
 }
 
-void expand_vars(ast_t* ast) {
+// Where expand_vars() builds its result: on the stack, until that's not
+// big enough.
+typedef struct {
+    char*  buf;
+    size_t len, cap;
+    char   stack[256];
+} expand_buf_t;
+
+static void expand_put(expand_buf_t* eb, const char* str, size_t len) {
+    if (eb->len + len + 1 > eb->cap) {
+        size_t cap = eb->cap * 2;
+        while (cap < eb->len + len + 1)
+            cap *= 2;
+        if (eb->buf == eb->stack) {
+            eb->buf = malloc_trap(cap);
+            memcpy(eb->buf, eb->stack, eb->len);
+        } else {
+            eb->buf = realloc_trap(eb->buf, cap);
+        }
+        eb->cap = cap;
+    }
+    memcpy(&eb->buf[eb->len], str, len);
+    eb->len += len;
+}
+
+void expand_vars(ysh_t* sh, ast_t* ast) {
     assert(ast->type == AST_STR);
 
-    char *ptr_old = (char*) ast->ptr;
-    size_t ptr_sz = ast->size;
-    size_t new_sz = 0;
-    size_t v_at = 0, v_sz = 0;
-    char *new = NULL, *var = NULL;
-
-    int mode = 0;
-    for(size_t i=0; i < ptr_sz && ptr_old[i] != 0; i++) {
-        switch (ptr_old[i]) {
-            case '$':
-                i++;
-                v_at = i;
-                while((isalpha(ptr_old[i]) || ptr_old[i] == '_') &&
-                      i < ptr_sz && ptr_old[i] != 0)
-                    i++;
-                v_sz = i - v_at;
-                if (ptr_old[i] != '$') {
-                    i--;
-                }
-                var = malloc_trap(v_sz + 1);
-                memset(var, 0, v_sz + 1);
-                memcpy(var, &ptr_old[v_at], v_sz);
+    int stage = alloc_stage_enter(ALLOC_EXPAND_VARS);
+    char *ptr_old = ast_str(ast);
+    size_t ptr_sz = strnlen(ptr_old, ast->size);
 
-                // TODO - get map for $var and insert to output
+    // Most strings have nothing to expand, and are just copied; which for
+    // short ones means no allocation at all.
+    if (!memchr(ptr_old, '$', ptr_sz)) {
+        ast_set_str(ast, ptr_old, ptr_sz);
+        alloc_stage_leave(stage);
+        return;
+    }
 
-                break;
-            default:
-                new_sz++;
-                new = realloc_trap(new, new_sz);
-                new[new_sz-1] = ptr_old[i];
-                break;
+    expand_buf_t eb;
+    eb.buf = eb.stack;
+    eb.len = 0;
+    eb.cap = sizeof(eb.stack);
+
+    for(size_t i=0; i < ptr_sz; i++) {
+        if (ptr_old[i] != '$') {
+            size_t run = i;
+            while (run < ptr_sz && ptr_old[run] != '$')
+                run++;
+            expand_put(&eb, &ptr_old[i], run - i);
+            i = run - 1;
+            continue;
         }
+
+        i++;
+        size_t v_at = i;
+        while(i < ptr_sz && (isalpha(ptr_old[i]) || ptr_old[i] == '_'))
+            i++;
+        size_t v_sz = i - v_at;
+        // A '$' right after the name only ends it ("$a$b" is $a then b.)
+        if (i >= ptr_sz || ptr_old[i] != '$')
+            i--;
+
+        char name_buf[64];
+        char* name = v_sz < sizeof(name_buf) ? name_buf : malloc_trap(v_sz + 1);
+        memcpy(name, &ptr_old[v_at], v_sz);
+        name[v_sz] = 0;
+
+        const char* val = var_get(&sh->vars, name);
+        if (val)
+            expand_put(&eb, val, strlen(val));
+        if (name != name_buf)
+            free_trap(name);
+    }
+
+    if (eb.buf == eb.stack)
+        ast_set_str(ast, eb.stack, eb.len);
+    else
+        ast_take_str(ast, eb.buf, eb.len);
+    alloc_stage_leave(stage);
+}
+
+/* Makes ast a string node holding a terminated copy of str; inline if
+ * it fits. str may point into ast itself.
+ */
+void ast_set_str(ast_t* ast, const char* str, size_t len) {
+    if (len <= AST_INLINE_MAX) {
+        memmove(ast->inl, str, len);
+        ast->inl[len] = 0;
+        ast->flags = AST_F_INLINE;
+    } else {
+        char* buf = malloc_trap(len + 1);
+        memcpy(buf, str, len);
+        buf[len] = 0;
+        ast->str = buf;
+        ast->flags = AST_F_OWNED;
+    }
+    ast->size = len;
+}
+
+/* Same as ast_set_str, but takes over buf (which must have room for
+ * len + 1 bytes) rather than copying it, unless it's short enough to
+ * go inline.
+ */
+void ast_take_str(ast_t* ast, char* buf, size_t len) {
+    buf[len] = 0;
+    if (len <= AST_INLINE_MAX) {
+        memcpy(ast->inl, buf, len + 1);
+        ast->flags = AST_F_INLINE;
+        free_trap(buf);
+    } else {
+        ast->str = buf;
+        ast->flags = AST_F_OWNED;
     }
+    ast->size = len;
+}
 
-    ast->ptr = new;
-    ast->size = new_sz;
+static void ast_free_children(ast_t* ast) {
+    if (ast->type == AST_STR || ast->type == AST_LIT) {
+        if (ast->flags & AST_F_OWNED)
+            free_trap(ast->str);
+        return;
+    }
 
-//    printf("(%ld) %s", ast->size, (char*)ast->ptr);
+    for(size_t id = 0; id < ast->size; id++)
+        ast_free_children(&ast->kids[id]);
+    free_trap(ast->kids);
 }
 
-void ast_resolve_subs(ast_t* ast, int master) {
-    for(size_t id = 0; id < ast->size; id++) {
-        ast_t* chk = &((ast_t*)ast->ptr)[id];
-        if (chk->type == AST_ROOT || chk->type == AST_GRP)
-            ast_resolve_subs(chk, 0);
-        // If needed, expand variables in strings.
-        if (chk->type == AST_STR)
-            expand_vars(chk);
+/* Frees a tree from either parse() or resolve(). */
+void ast_free(ast_t* ast) {
+    if (!ast)
+        return;
+    ast_free_children(ast);
+    free_trap(ast);
+}
+
+/* Resolves ast into out. The input tree is never modified, so a parsed
+ * tree can be resolved as many times as needed (see builtin/loop.c);
+ * the result is a separate tree which owns all of its strings.
+ */
+void ast_resolve_subs(ysh_t* sh, const ast_t* ast, ast_t* out, int master) {
+    *out = *ast;
+
+    if (ast->type == AST_LIT) {
+        // Single-quoted strings are left as typed.
+        out->type = AST_STR;
+        ast_set_str(out, ast_str(ast), ast->size);
+        return;
+    } else if (ast->type == AST_STR) {
+        // If needed, expand variables in strings. This always leaves
+        // out with a terminated string of its own.
+        expand_vars(sh, out);
+        return;
     }
 
-    if (obscene_debug) ast_dump_print(ast, 0);
+    out->kids = malloc_trap(sizeof(ast_t) * (ast->size ? ast->size : 1));
+    for(size_t id = 0; id < ast->size; id++)
+        ast_resolve_subs(sh, &ast->kids[id], &out->kids[id], 0);
+
+    if (sh->debug) ast_dump_print(sh, out, 0);
 
     // No more AST_ROOT or AST_GRP left to fix up. Now, depending
     // on type, we need to do the following:
@@ -245,42 +447,51 @@ void ast_resolve_subs(ast_t* ast, int master) {
 
     if (master) return; // Don't fuck the tree's root node.
 
-    if (ast->type == AST_ROOT) {
+    if (out->type == AST_ROOT) {
         char *output = NULL;
-        execute(ast, &output);
-        free(ast->ptr);
-        ast->type = AST_STR;
-        ast->ptr = output;
-        ast->size = strlen(output);
-    } else if (ast->type == AST_GRP) {
+        cmd_io_t io = { sh->in, sh->out, &output };
+        execute(sh, out, &io);
+        ast_free_children(out);
+        out->type = AST_STR;
+        if (!output) {
+            // Nothing was printed (e.g. a builtin like cd.)
+            output = malloc_trap(1);
+            output[0] = 0;
+        }
+        ast_take_str(out, output, strlen(output));
+    } else if (out->type == AST_GRP) {
         size_t total = 0;
         size_t at = 0;
         char *buf = malloc_trap(1);
-        for(size_t id = 0; id < ast->size; id++) {
-            ast_t* chk = &((ast_t*)ast->ptr)[id];
+        for(size_t id = 0; id < out->size; id++) {
+            ast_t* chk = &out->kids[id];
 
             total += chk->size;
-            buf = realloc_trap(buf, total);
+            buf = realloc_trap(buf, total + 1);
 
-            memcpy(&buf[at], chk->ptr, chk->size);
+            memcpy(&buf[at], ast_str(chk), chk->size);
             at += chk->size;
         }
-        free(ast->ptr);
-        ast->type = AST_STR;
-        ast->ptr  = buf;
-        ast->size = total;
+        ast_free_children(out);
+        out->type = AST_STR;
+        ast_take_str(out, buf, total);
     }
 }
 
-ast_t* resolve(ast_t* tree) {
+ast_t* resolve(ysh_t* sh, ast_t* tree) {
     // This traverses the tree, executing subshell commands,
     // expanding escape sequences within strings, etc
     // until only the top-level AST_ROOT remains with no more
-    // expansion needed.
+    // expansion needed. The result is a new tree; the one passed in
+    // is left as-is.
+
+    int stage = alloc_stage_enter(ALLOC_RESOLVE);
+    ast_t* out = malloc_trap(sizeof(ast_t));
+    ast_resolve_subs(sh, tree, out, 1);
 
-    ast_resolve_subs(tree, 1);
+    if (sh->debug) ast_dump_print(sh, out, 0);
 
-    if (obscene_debug) ast_dump_print(tree, 0);
+    alloc_stage_leave(stage);
 
-    return tree;
+    return out;
 }
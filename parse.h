@@ -1,14 +1,26 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdint.h>
+
+#include "ysh.h"
+
 // Unset. Not used in practice.
 #define AST_UNSET 0
 // Root element split to parameters.
 #define AST_ROOT 1
-// A fixed size string; ptr should be a char*
+// A fixed size string; see ast_str()
 #define AST_STR  2
 // Multiple elements which must be concatentated together to form a complete string.
 #define AST_GRP  3
+// A string from single quotes; same as AST_STR, but never expanded.
+#define AST_LIT  4
+// Redirections (<, > and >>); always exactly one child, the target file.
+#define AST_REDIR_IN  5
+#define AST_REDIR_OUT 6
+#define AST_REDIR_APP 7
+
+#define AST_IS_REDIR(t) ((t) >= AST_REDIR_IN && (t) <= AST_REDIR_APP)
 
 // Suppose the following input:
 //   echo $(printf %x $(echo 42)) "hi world"
@@ -32,18 +44,49 @@
 // Postnote; implementation is a bit different as one can see in --obscene
 // mode.
 
+// Strings of up to this many characters are stored in the node itself.
+#define AST_INLINE_MAX 15
+
+// Set when the string is in inl rather than pointed to by str.
+#define AST_F_INLINE 1
+// Set when str was allocated for this node and is freed with it.
+#define AST_F_OWNED  2
+// Set on a root from parse() when the line was a syntax error. The root is
+// then empty, and executing it fails with status 2.
+#define AST_F_ERROR  4
+
+// Nodes are 24 bytes. Children of a node are always one contiguous array,
+// and short strings (which is nearly all of them; command names, flags and
+// the like) live inline, so most command lines are a couple of allocations
+// in total.
+//
+// Strings in a tree from resolve() are always NUL-terminated, so argv can
+// point straight at them. Long strings in a tree from parse() point into
+// the parsed line and are not; use size.
 typedef struct ast_s {
-    int    type;
-    size_t size; // Number of elements for AST_ROOT|AST_GRP,
-                 // and number of characters for AST_STR
-    void*  ptr;  // either ast_s* or char*
+    uint8_t  type;
+    uint8_t  flags;
+    uint32_t size; // Number of elements for AST_ROOT|AST_GRP,
+                   // and number of characters for AST_STR
+    union {
+        struct ast_s* kids;
+        char*         str;
+        char          inl[AST_INLINE_MAX + 1];
+    };
 } ast_t;
 
-void ast_dump_print(ast_t* ast, size_t indent);
-void split_line(char* line, size_t len, ast_t** ast, size_t* siz, int mode);
-ast_t* parse(char* data);
-void expand_vars(ast_t* ast);
-void ast_resolve_subs(ast_t* ast, int master);
-ast_t* resolve(ast_t* tree);
+static inline char* ast_str(const ast_t* ast) {
+    return (ast->flags & AST_F_INLINE) ? (char*)ast->inl : ast->str;
+}
+
+void ast_dump_print(ysh_t* sh, ast_t* ast, size_t indent);
+int split_line(ysh_t* sh, char* line, size_t len, ast_t** ast, uint32_t* siz, int mode);
+ast_t* parse(ysh_t* sh, char* data);
+void expand_vars(ysh_t* sh, ast_t* ast);
+void ast_set_str(ast_t* ast, const char* str, size_t len);
+void ast_take_str(ast_t* ast, char* buf, size_t len);
+void ast_free(ast_t* ast);
+void ast_resolve_subs(ysh_t* sh, const ast_t* ast, ast_t* out, int master);
+ast_t* resolve(ysh_t* sh, ast_t* tree);
 
 #endif
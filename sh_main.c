@@ -10,25 +10,49 @@
 
 #include "parse.h"
 #include "util.h"
+#include "shell.h"
+#include "alloc.h"
 
-// Exit the main interactive loop
-int shell_do_exit = 0;
-
-// Various flags.
-int obscene_debug = 0;
+static void alloc_line_print() {
+    char buf[2048];
+    int len = alloc_report(buf, sizeof(buf), 0);
+    if (len >= (int)sizeof(buf))
+        len = sizeof(buf) - 1;
+    write(2, buf, len);
+}
 
 int main(int argc, char **argv) {
     char* run_str = NULL;
+    int debug = 0;
+    uint64_t line_timeout = 0;
+
+    // By default allow a few children per CPU to be alive at once; enough
+    // to never get in the way of normal use, but not unbounded.
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    ysh_child_limit(ncpu > 0 ? ncpu * 4 : 16);
+
     // Options.
     int c;
-    while ((c = getopt (argc, argv, "Dc:")) != -1) {
+    while ((c = getopt (argc, argv, "ADc:j:T:")) != -1) {
         switch(c) {
+            case 'A':
+                // Allocation accounting, reported after each line.
+                alloc_prof_enable();
+                break;
             case 'D':
-                obscene_debug = 1;
+                debug = 1;
                 break;
             case 'c':
                 run_str = optarg;
                 break;
+            case 'j':
+                // Most children alive at once; 0 for no limit.
+                ysh_child_limit(strtoul(optarg, NULL, 0));
+                break;
+            case 'T':
+                // Deadline for each line, subcommands and all, in seconds.
+                line_timeout = strtod(optarg, NULL) * 1000000;
+                break;
             case '?':
                 printf("Invalid invocation.\n");
                 return 1;
@@ -39,23 +63,43 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Only once the options are in, so -A sees everything it allocates.
+    ysh_t* sh = ysh_new();
+    ysh_set_debug(sh, debug);
+    ysh_set_timeout(sh, line_timeout);
+
     if (run_str) {
-        ast_t *toks = parse(run_str);
-        toks        = resolve(toks);
-        execute(toks, NULL);
-        free(toks->ptr);
-        free(toks);
+        if (alloc_prof) alloc_line_begin();
+        ysh_run(sh, run_str);
+        if (alloc_prof) alloc_line_print();
     } else {
-        while (!shell_do_exit) {
+        // $YSH_HISTFILE wins; otherwise it lives in $HOME. No history
+        // is kept if neither is set.
+        char* hist_path = getenv("YSH_HISTFILE");
+        char* home = getenv("HOME");
+        if (hist_path) {
+            history_open(&sh->hist, hist_path);
+        } else if (home) {
+            size_t len = strlen(home) + sizeof("/.ysh_history");
+            hist_path = malloc_trap(len);
+            snprintf(hist_path, len, "%s/.ysh_history", home);
+            history_open(&sh->hist, hist_path);
+            free_trap(hist_path);
+        }
+
+        while (!sh->do_exit) {
             // Read a command in.
+            if (alloc_prof) alloc_line_begin();
             char *input  = read_input();
-            ast_t *toks  = parse(input);
-            toks         = resolve(toks);
-            execute(toks, NULL);
-            free(toks->ptr);
-            free(toks);
-            // FIXME: free the damn toks memory, this requires traversing to the bottom tho
-            free(input);
+            if (!input)
+                break;
+            ysh_run(sh, input);
+            // Only once it's run, so that `history -s` never finds itself.
+            history_add(&sh->hist, input);
+            free_trap(input);
+            if (alloc_prof) alloc_line_print();
         }
     }
+
+    ysh_free(sh);
 }
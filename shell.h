@@ -0,0 +1,42 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+// The inside of a ysh_t (see ysh.h). Everything that used to be a global
+// is here instead, and gets passed down from ysh_run() to whatever needs
+// it, so that interpreters never see each other's state.
+
+#include <stdint.h>
+
+#include "ysh.h"
+#include "vars.h"
+#include "stats.h"
+#include "history.h"
+#include "memo.h"
+#include "supervise.h"
+
+struct ysh_s {
+    int        debug;    // Dump trees as they're parsed and resolved.
+    int        do_exit;  // Exit the main interactive loop.
+
+    int        in;       // Default input, output and error descriptors.
+    int        out;
+    int        err;
+    int        cwd;      // Directory fd; relative paths start here.
+
+    uint64_t   line_timeout; // Deadline for each line, or 0.
+    deadline_t deadline;
+
+    int        threaded; // On a thread of its own (see ysh_child).
+
+    vars_t     vars;
+    stats_t    stats;
+    cmd_usage_t spent;   // Children reaped and threads joined, so far.
+    hist_t     hist;
+    memo_t     memo;
+};
+
+ysh_t* ysh_child(ysh_t* sh);
+void ysh_child_reset(ysh_t* sh, ysh_t* child);
+void ysh_child_join(ysh_t* sh, ysh_t* child);
+
+#endif
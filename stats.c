@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "stats.h"
+
+// Per-command-name totals for the session. There are rarely more than a
+// few dozen distinct command names in play, so this is just a list with
+// the most recently used entry moved to the front; scripts tend to run the
+// same handful of commands over and over. Each interpreter keeps its own.
+
+static uint64_t tv_us(struct timeval tv) {
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Fills in usage from what getrusage() or wait4() reported. There's no
+ * wall time in there; that's left at 0.
+ */
+void usage_from_rusage(cmd_usage_t* usage, const struct rusage* ru) {
+    usage->wall_us   = 0;
+    usage->user_us   = tv_us(ru->ru_utime);
+    usage->sys_us    = tv_us(ru->ru_stime);
+    usage->maxrss_kb = ru->ru_maxrss;
+    usage->minflt    = ru->ru_minflt;
+    usage->majflt    = ru->ru_majflt;
+    usage->nvcsw     = ru->ru_nvcsw;
+    usage->nivcsw    = ru->ru_nivcsw;
+}
+
+/* Adds src to dst; peak RSS is the larger of the two rather than a sum. */
+void usage_add(cmd_usage_t* dst, const cmd_usage_t* src) {
+    dst->wall_us += src->wall_us;
+    dst->user_us += src->user_us;
+    dst->sys_us  += src->sys_us;
+    dst->minflt  += src->minflt;
+    dst->majflt  += src->majflt;
+    dst->nvcsw   += src->nvcsw;
+    dst->nivcsw  += src->nivcsw;
+    if (src->maxrss_kb > dst->maxrss_kb)
+        dst->maxrss_kb = src->maxrss_kb;
+}
+
+stats_ent_t* stats_find(stats_t* stats, const char* name) {
+    for (stats_ent_t* ent = stats->list; ent; ent = ent->next) {
+        if (!strcmp(ent->name, name))
+            return ent;
+    }
+    return NULL;
+}
+
+void stats_record(stats_t* stats, const char* name, const cmd_usage_t* usage) {
+    assert(name && usage);
+
+    stats_ent_t** at = &stats->list;
+    while (*at && strcmp((*at)->name, name))
+        at = &(*at)->next;
+
+    stats_ent_t* ent = *at;
+    if (ent) {
+        *at = ent->next;
+    } else {
+        size_t len = strlen(name) + 1;
+        ent = malloc_trap(sizeof(stats_ent_t));
+        memset(ent, 0, sizeof(stats_ent_t));
+        ent->name = malloc_trap(len);
+        memcpy(ent->name, name, len);
+    }
+    ent->next = stats->list;
+    stats->list = ent;
+
+    ent->count++;
+    usage_add(&ent->total, usage);
+
+    size_t bucket = 0;
+    while (bucket < STATS_BUCKETS - 1 && (usage->wall_us >> bucket))
+        bucket++;
+    ent->hist[bucket]++;
+}
+
+/* Adds everything recorded in src to dst. */
+void stats_merge(stats_t* dst, stats_t* src) {
+    for (stats_ent_t* from = src->list; from; from = from->next) {
+        stats_ent_t* ent = stats_find(dst, from->name);
+        if (!ent) {
+            size_t len = strlen(from->name) + 1;
+            ent = malloc_trap(sizeof(stats_ent_t));
+            memset(ent, 0, sizeof(stats_ent_t));
+            ent->name = malloc_trap(len);
+            memcpy(ent->name, from->name, len);
+            ent->next = dst->list;
+            dst->list = ent;
+        }
+
+        ent->count += from->count;
+        usage_add(&ent->total, &from->total);
+
+        for (size_t i = 0; i < STATS_BUCKETS; i++)
+            ent->hist[i] += from->hist[i];
+    }
+}
+
+stats_ent_t* stats_first(stats_t* stats) {
+    return stats->list;
+}
+
+void stats_reset(stats_t* stats) {
+    while (stats->list) {
+        stats_ent_t* ent = stats->list;
+        stats->list = ent->next;
+        free_trap(ent->name);
+        free_trap(ent);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+// Resources used by a single command. For external commands this comes
+// straight from wait4(); for builtins it's the difference in getrusage()
+// for the thread running them over the call, plus whatever they ran
+// themselves.
+typedef struct cmd_usage_s {
+    uint64_t wall_us;
+    uint64_t user_us;
+    uint64_t sys_us;
+    long     maxrss_kb;
+    long     minflt;
+    long     majflt;
+    long     nvcsw;
+    long     nivcsw;
+} cmd_usage_t;
+
+// Wall time histogram buckets; bucket n counts commands which took
+// less than 2^n microseconds (and at least 2^(n-1).)
+#define STATS_BUCKETS 32
+
+typedef struct stats_ent_s {
+    struct stats_ent_s* next;
+    char*       name;
+    uint64_t    count;
+    cmd_usage_t total;  // maxrss_kb here is the largest seen, not a sum.
+    uint64_t    hist[STATS_BUCKETS];
+} stats_ent_t;
+
+// One interpreter's stats. All zero is empty.
+typedef struct {
+    stats_ent_t* list;
+} stats_t;
+
+void usage_from_rusage(cmd_usage_t* usage, const struct rusage* ru);
+void usage_add(cmd_usage_t* dst, const cmd_usage_t* src);
+
+void stats_record(stats_t* stats, const char* name, const cmd_usage_t* usage);
+stats_ent_t* stats_first(stats_t* stats);
+stats_ent_t* stats_find(stats_t* stats, const char* name);
+void stats_merge(stats_t* dst, stats_t* src);
+void stats_reset(stats_t* stats);
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "parse.h"
+#include "util.h"
+#include "supervise.h"
+#include "alloc.h"
+
+// Everything about looking after a running child lives here: how many may
+// be alive at once, how long they're allowed to run, and waiting for them
+// to finish (and for their output) without getting stuck on either.
+//
+// On Linux 5.3 and later a child is watched through a pidfd, which polls
+// readable once the child exits; that goes into the same poll() as its
+// output pipe, so one loop handles output, exit and the deadline without
+// signals or busy waiting. Anywhere else we fall back to polling the pipe
+// and checking on the child every few milliseconds.
+
+// How long a child gets between SIGTERM and SIGKILL once its deadline
+// passes.
+#define KILL_GRACE_US 1000000
+
+static size_t          child_max = 0; // 0 is no limit.
+static size_t          child_live = 0;
+static pthread_mutex_t child_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  child_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void child_limit_set(size_t max) {
+    pthread_mutex_lock(&child_lock);
+    child_max = max;
+    pthread_cond_broadcast(&child_cond);
+    pthread_mutex_unlock(&child_lock);
+}
+
+/* Blocks until another child is allowed to be started, or until the
+ * deadline dl passes. Returns 0 with a slot, which must be released once
+ * the child has been reaped, or -1 if the deadline came first.
+ */
+int child_slot_acquire(deadline_t* dl) {
+    int ret = 0;
+
+    pthread_mutex_lock(&child_lock);
+    while (child_max && child_live >= child_max) {
+        if (!dl->at) {
+            pthread_cond_wait(&child_cond, &child_lock);
+            continue;
+        }
+
+        uint64_t now = now_us();
+        if (now >= dl->at) {
+            ret = -1;
+            break;
+        }
+
+        // The wait times out against CLOCK_REALTIME, so what's left of the
+        // deadline is turned into one of those, again after every wakeup.
+        uint64_t left = dl->at - now;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec  += left / 1000000;
+        ts.tv_nsec += (left % 1000000) * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&child_cond, &child_lock, &ts);
+    }
+    if (!ret)
+        child_live++;
+    pthread_mutex_unlock(&child_lock);
+
+    return ret;
+}
+
+void child_slot_release() {
+    pthread_mutex_lock(&child_lock);
+    child_live--;
+    pthread_cond_signal(&child_cond);
+    pthread_mutex_unlock(&child_lock);
+}
+
+/* Makes the deadline at most timeout_us from now (0 leaves it alone), and
+ * returns the old one for deadline_restore() once the command is done.
+ * Deadlines only ever get tighter; a timeout inside a line with its own
+ * deadline can't outlive the line.
+ */
+uint64_t deadline_narrow(deadline_t* dl, uint64_t timeout_us) {
+    uint64_t prev = dl->at;
+    if (timeout_us) {
+        uint64_t at = now_us() + timeout_us;
+        if (!dl->at || at < dl->at)
+            dl->at = at;
+    }
+    return prev;
+}
+
+void deadline_restore(deadline_t* dl, uint64_t prev) {
+    dl->at = prev;
+}
+
+int deadline_expired(deadline_t* dl) {
+    return dl->at && now_us() >= dl->at;
+}
+
+// Whether anything has been stopped for missing its deadline since the
+// last deadline_hit_clear().
+int deadline_hit(deadline_t* dl) {
+    return dl->fired;
+}
+
+void deadline_hit_clear(deadline_t* dl) {
+    dl->fired = 0;
+}
+
+static int pidfd_open_compat(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// With group, pid leads a process group of its own, and everything in it
+// gets the signal. Until pid is reaped nothing else can take its pid, so
+// neither can anything else end up with the group's.
+static void child_signal(pid_t pid, int pidfd, int group, int sig) {
+    if (group && kill(-pid, sig) == 0)
+        return;
+#ifdef SYS_pidfd_send_signal
+    // Through the pidfd there's no chance of hitting a recycled pid.
+    if (pidfd != -1 && syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0) == 0)
+        return;
+#endif
+    kill(pid, sig);
+}
+
+static void capture_read(int fd, char** buf, size_t* len, size_t* cap, int* open) {
+    if (*cap - *len < 4096) {
+        int stage = alloc_stage_enter(ALLOC_CAPTURE);
+        *cap = *cap ? *cap * 2 : 4096;
+        *buf = realloc_trap(*buf, *cap + 1);
+        alloc_stage_leave(stage);
+    }
+
+    ssize_t bytes = read(fd, &(*buf)[*len], *cap - *len);
+    if (bytes > 0) {
+        *len += bytes;
+    } else if (bytes == 0 || errno != EINTR) {
+        *open = 0;
+    }
+}
+
+/* Waits for pid to exit while collecting its output from out_fd into
+ * capture (when out_fd isn't -1), and reaps it into wstatus and ru.
+ * If the deadline dl passes first the child is sent SIGTERM, and SIGKILL if
+ * it's still around KILL_GRACE_US later. Returns 1 if that happened.
+ *
+ * With group (pid was put in a process group of its own) the signals go to
+ * the whole group, and anything left in it once pid has gone is killed too,
+ * so nothing it started outlives the deadline.
+ */
+int child_supervise(deadline_t* dl, pid_t pid, int group, int out_fd, char** capture, int* wstatus, struct rusage* ru) {
+    int    pidfd = pidfd_open_compat(pid);
+    int    out_open = out_fd != -1;
+    int    exited = 0, timed_out = 0;
+    char*  buf = NULL;
+    size_t len = 0, cap = 0;
+    uint64_t kill_at = dl->at;
+
+    while (!exited || out_open) {
+        if (pidfd == -1 && !out_open && !kill_at)
+            break; // Nothing to watch for; just wait4 below.
+
+        struct pollfd fds[2];
+        nfds_t nfds = 0;
+        if (out_open) {
+            fds[nfds].fd = out_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (!exited && pidfd != -1) {
+            fds[nfds].fd = pidfd;
+            fds[nfds++].events = POLLIN;
+        }
+
+        int timeout = -1;
+        if (exited) {
+            // The child is gone, but something it started may still hold
+            // the pipe open. Take what's already there and stop.
+            timeout = 0;
+        } else if (pidfd == -1) {
+            timeout = 10; // No pidfd, so check on the child ourselves.
+        }
+        if (kill_at && !exited) {
+            uint64_t now = now_us();
+            int left = now >= kill_at ? 0 : (kill_at - now + 999) / 1000;
+            if (timeout == -1 || left < timeout)
+                timeout = left;
+        }
+
+        int ready = poll(fds, nfds, timeout);
+        if (ready == -1 && errno != EINTR)
+            break;
+
+        for (nfds_t i = 0; ready > 0 && i < nfds; i++) {
+            if (!fds[i].revents)
+                continue;
+            if (fds[i].fd == out_fd)
+                capture_read(out_fd, &buf, &len, &cap, &out_open);
+            else
+                exited = 1;
+        }
+
+        if (ready == 0 && exited)
+            break;
+
+        if (!exited && pidfd == -1) {
+            // Peek without reaping; wait4 below still wants the rusage.
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid)
+                exited = 1;
+        }
+
+        if (!exited && kill_at && now_us() >= kill_at) {
+            child_signal(pid, pidfd, group, timed_out ? SIGKILL : SIGTERM);
+            kill_at = timed_out ? 0 : now_us() + KILL_GRACE_US;
+            timed_out = 1;
+        }
+    }
+
+    if (pidfd != -1)
+        close(pidfd);
+
+    // pid may have gone after SIGTERM while something it started ignored
+    // it. pid isn't reaped yet, so the group is still safe to signal.
+    if (timed_out && group)
+        kill(-pid, SIGKILL);
+
+    if (wait4(pid, wstatus, 0, ru) == -1) {
+        *wstatus = 0;
+        memset(ru, 0, sizeof(*ru));
+    }
+
+    if (timed_out)
+        dl->fired = 1;
+
+    if (capture) {
+        if (!buf) {
+            int stage = alloc_stage_enter(ALLOC_CAPTURE);
+            buf = malloc_trap(1);
+            alloc_stage_leave(stage);
+        }
+        // Strip the last \n from output, if applicable.
+        if (len && buf[len-1] == '\n')
+            len--;
+        buf[len] = 0;
+        *capture = buf;
+    } else {
+        free_trap(buf);
+    }
+
+    return timed_out;
+}
@@ -0,0 +1,32 @@
+#ifndef SUPERVISE_H
+#define SUPERVISE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// Exit status given to anything stopped for running past its deadline;
+// same as coreutils timeout(1).
+#define DEADLINE_STATUS 124
+
+// When the command currently running in an interpreter has to be done
+// by. All zero is no deadline.
+typedef struct {
+    uint64_t at;    // Absolute CLOCK_MONOTONIC microseconds, or 0 for none.
+    int      fired; // Something was stopped for passing it.
+} deadline_t;
+
+// The child limit is shared by every interpreter in the process.
+void child_limit_set(size_t max);
+int child_slot_acquire(deadline_t* dl);
+void child_slot_release();
+
+uint64_t deadline_narrow(deadline_t* dl, uint64_t timeout_us);
+void deadline_restore(deadline_t* dl, uint64_t prev);
+int deadline_expired(deadline_t* dl);
+int deadline_hit(deadline_t* dl);
+void deadline_hit_clear(deadline_t* dl);
+
+int child_supervise(deadline_t* dl, pid_t pid, int group, int out_fd, char** capture, int* wstatus, struct rusage* ru);
+
+#endif
@@ -1,18 +1,50 @@
+// glibc only declares pipe2 and RUSAGE_THREAD (Linux-only, and used only
+// there) with _GNU_SOURCE.
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#include <errno.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "parse.h"
 #include "util.h"
+#include "shell.h"
+#include "alloc.h"
+
+extern char** environ;
 
 builtin_info_t builtin_info[] = {
     { "cd",  builtin_chdir },
+    { "cat", builtin_cat },
+    { "history", builtin_history },
+
+    { "=",       builtin_set },
+    { "export",  builtin_export },
+    { "unset",   builtin_unset },
+
+    { "time",    builtin_time },
+    { "stats",   builtin_stats },
+    { "allocs",  builtin_allocs },
+    { "timeout", builtin_timeout },
+    { "memo",    builtin_memo },
+
+    { "repeat",  builtin_repeat },
+    { "for",     builtin_for },
+    { "while",   builtin_while },
+    { "map",     builtin_map },
+    { "each",    builtin_map },
 
     { "+",   builtin_add },
     { "x+",  builtin_add },
@@ -48,22 +80,63 @@ void* malloc_trap(size_t malloc_size) {
         perror("err: malloc_trap: \n");
         exit(EXIT_FAILURE);
     }
+    if (alloc_prof)
+        alloc_note_malloc(ret, malloc_size);
     return ret;
 }
 
 void* realloc_trap(void *ptr, size_t malloc_size) {
+    uintptr_t old = (uintptr_t)ptr; // Only ever used as a key afterwards.
     void* ret = realloc(ptr, malloc_size);
     if (!ret) {
         perror("err: realloc_trap: \n");
         exit(EXIT_FAILURE);
     }
+    if (alloc_prof)
+        alloc_note_realloc(old, ret, malloc_size);
     return ret;
 }
 
+void free_trap(void *ptr) {
+    if (!ptr)
+        return;
+    if (alloc_prof)
+        alloc_note_free(ptr);
+    free(ptr);
+}
+
+/* Sends output from a builtin to the right place; appended to the capture
+ * buffer when running as a subcommand, or to the command's output
+ * descriptor otherwise.
+ */
+void builtin_output(cmd_io_t* io, const char* str, size_t len) {
+    if (!io->capture) {
+        while (len) {
+            ssize_t ret = write(io->out, str, len);
+            if (ret == -1) {
+                perror("write");
+                return;
+            }
+            str += ret;
+            len -= ret;
+        }
+        return;
+    }
+
+    int stage = alloc_stage_enter(ALLOC_CAPTURE);
+    char** out = io->capture;
+    size_t at = *out ? strlen(*out) : 0;
+    *out = realloc_trap(*out, at + len + 1);
+    memcpy(&(*out)[at], str, len);
+    (*out)[at + len] = 0;
+    alloc_stage_leave(stage);
+}
+
 /* Reads input from the user; this includes single lines, as well as
  * escaped multi-line input.
  *
- * This is essentially an implementation of getline.
+ * This is essentially an implementation of getline. Returns NULL once
+ * input is exhausted.
  */
 char *read_input() {
     // We do not know the size of the buffer ahead of time; therefore,
@@ -75,6 +148,7 @@ char *read_input() {
     // To avoid allocation overhead, we work in a "chunk" size specified by
     // BUF_CHUNKSIZ, and each time the buffer must be grown, we double
     // the currently allocated size to try and avoid problems.
+    int stage = alloc_stage_enter(ALLOC_READ_INPUT);
     size_t buffer_sz = BUF_CHUNKSIZ;
     char *buffer = (char*)malloc_trap(buffer_sz);
     size_t pos = 0;
@@ -95,8 +169,13 @@ char *read_input() {
             // Terminate reading input when EOF or if we receive an "unescaped" newline.
             --pos; // Don't copy the '\\' into output.
             fflush(stdout);
+        } else if (c == EOF && pos == 0) {
+            free_trap(buffer);
+            alloc_stage_leave(stage);
+            return NULL;
         } else if (c == EOF || c == '\n') {
             buffer[pos] = 0;
+            alloc_stage_leave(stage);
             return buffer;
         }
 
@@ -121,53 +200,270 @@ int check_builtin(char* name) {
     return -1;
 }
 
-pid_t fork_and_execvp(const char *file, char *const argv[], char** stdout) {
+// Whether fd is a terminal with our process group in the foreground.
+static int tty_foreground(int fd) {
+    return isatty(fd) && tcgetpgrp(fd) == getpgrp();
+}
+
+/* Runs file as a child process with io applied, in sh's working directory
+ * and environment, and waits for it (and its output, for a subcommand)
+ * under sh's deadline. Returns its exit status, with the resources it used
+ * in ru.
+ */
+int fork_and_execvp(ysh_t* sh, const char *file, char *const argv[], cmd_io_t* io, struct rusage* ru) {
     pid_t pid;
+    char** stdout = io->capture;
 
-    int pipefd[2];
-    if (stdout)
-        pipe(pipefd);
+    memset(ru, 0, sizeof(*ru));
+
+    if (deadline_expired(&sh->deadline)) {
+        dprintf(sh->err, "%s: not started, deadline has passed\n", file);
+        return DEADLINE_STATUS;
+    }
+
+    // Both ends are close-on-exec, so that children started concurrently
+    // don't inherit each other's pipes and keep them from ever hitting EOF.
+    // That has to be set by pipe2 itself; another thread could fork between
+    // a pipe and an fcntl.
+    int pipefd[2] = { -1, -1 };
+    if (stdout && pipe2(pipefd, O_CLOEXEC) == -1) {
+        dprintf(sh->err, "%s: pipe: %s\n", file, strerror(errno));
+        return 127;
+    }
+
+    // Under a deadline the child leads a process group of its own, so that
+    // whatever it starts can be stopped along with it. Not when it's
+    // reading from the terminal we're in the foreground of, though: we
+    // don't do job control, so a group of its own would be a background
+    // one, stopped as soon as it reads, and out of reach of ^C.
+    int group = sh->deadline.at && !tty_foreground(io->in);
+
+    // Anything a builtin printed must hit the terminal before the child
+    // starts writing to it.
+    fflush(NULL);
+
+    if (child_slot_acquire(&sh->deadline) == -1) {
+        if (stdout) {
+            close(pipefd[0]);
+            close(pipefd[1]);
+        }
+        dprintf(sh->err, "%s: not started, deadline has passed\n", file);
+        return DEADLINE_STATUS;
+    }
+
+    // The child execs with the environment exactly as it stands now; the
+    // snapshot is held across the fork so nothing can change it mid-launch.
+    env_snap_t* env = env_acquire(&sh->vars);
 
     pid = fork();
 
     if (pid == 0) {
+        if (group)
+            setpgid(0, 0);
+
+        // Errors go to sh's descriptor; copy it out of the way first, as
+        // it may well be one of the ones about to be replaced.
+        int err = sh->err != 2 ? fcntl(sh->err, F_DUPFD_CLOEXEC, 3) : 2;
+
+        if (io->in != 0)
+            dup2(io->in, 0);
+
         if (stdout) {
-            // Close the rx pipe in child.
-            close(pipefd[0]);
             dup2(pipefd[1], 1); // stdout -> pipe
-            close(pipefd[1]);
+        } else if (io->out != 1) {
+            dup2(io->out, 1);
+        }
+
+        if (err != 2)
+            dup2(err, 2);
+
+        // The process's own working directory belongs to nobody in
+        // particular; the child gets the interpreter's.
+        if (sh->cwd != AT_FDCWD && fchdir(sh->cwd) == -1) {
+            perror("cd");
+            _exit(127);
         }
 
+        environ = env->envp;
         execvp(file, argv);
+
+        // Still here means exec failed; don't let the child carry on as
+        // a second copy of the shell.
+        perror(file);
+        _exit(127);
+    }
+
+    env_release(env);
+
+    // Done on both sides, so that it's in place whichever runs first.
+    if (group && pid > 0)
+        setpgid(pid, pid);
+
+    // Close the tx pipe in parent.
+    if (stdout)
+        close(pipefd[1]);
+
+    int status = 127;
+    if (pid == -1) {
+        dprintf(sh->err, "%s: fork: %s\n", file, strerror(errno));
     } else {
-        if (stdout) {
-            size_t stdout_sz = 4096, stdout_at = 0;
-            *stdout = NULL;
-            char * cur = *stdout;
+        int wstatus = 0;
+        if (child_supervise(&sh->deadline, pid, group, pipefd[0], stdout, &wstatus, ru)) {
+            dprintf(sh->err, "%s: stopped, deadline has passed\n", file);
+            status = DEADLINE_STATUS;
+        }
+        else if (WIFEXITED(wstatus))
+            status = WEXITSTATUS(wstatus);
+        else
+            status = 128 + WTERMSIG(wstatus);
+
+        // Charged to whichever builtin this was run under, if any.
+        cmd_usage_t used;
+        usage_from_rusage(&used, ru);
+        usage_add(&sh->spent, &used);
+    }
 
-            // Close the tx pipe in parent.
-            close(pipefd[1]);
-            ssize_t bytes = 0;
-            do {
-                stdout_at++;
-                *stdout = realloc_trap(*stdout, stdout_sz * stdout_at);
-                cur = *stdout + (stdout_sz * (stdout_at-1));
-                memset(cur, 0, 4096);
-
-                bytes = read(pipefd[0], cur, stdout_sz);
-            } while (bytes != 0);
-
-            // Strip the last \n from output, if applicable.
-            size_t len = strlen(*stdout);
-            if ((*stdout)[len-1] == '\n')
-                (*stdout)[len-1] = 0;
+    if (stdout)
+        close(pipefd[0]);
+
+    child_slot_release();
+    return status;
+}
+
+// Usage of just the calling thread, where there's a way to get it.
+// Anywhere else it's the whole process's.
+#ifdef __linux__
+#define RUSAGE_OWN RUSAGE_THREAD
+#else
+#define RUSAGE_OWN RUSAGE_SELF
+#endif
+
+/* Runs argv as either a builtin or an external command, and returns its
+ * exit status. What it cost is recorded in sh's stats, and also copied to
+ * usage if that's non-NULL.
+ */
+int run_command(ysh_t* sh, char** argv, cmd_io_t* io, cmd_usage_t* usage) {
+    struct timespec start, end;
+    cmd_usage_t u;
+    int status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int builtin_chk = check_builtin(argv[0]);
+    if (builtin_chk != -1) {
+        // Builtins run on our own thread, so charge them the difference in
+        // its usage, plus whatever was used by children they reaped (or
+        // threads they ran, for map), which is collected in sh->spent.
+        cmd_usage_t spent = sh->spent;
+        memset(&sh->spent, 0, sizeof(sh->spent));
+
+        struct rusage self[2];
+        getrusage(RUSAGE_OWN, &self[0]);
+
+        status = builtin_info[builtin_chk].func(sh, argv[0], argv, io);
+
+        // As a subcommand, output loses its last '\n', the same as
+        // child_supervise does for external commands.
+        if (io->capture && *io->capture) {
+            size_t len = strlen(*io->capture);
+            if (len && (*io->capture)[len-1] == '\n')
+                (*io->capture)[len-1] = 0;
         }
 
+        getrusage(RUSAGE_OWN, &self[1]);
+
+        #define RU_DELTA(f) (self[1].f - self[0].f)
+        u.user_us   = RU_DELTA(ru_utime.tv_sec) * 1000000 + RU_DELTA(ru_utime.tv_usec);
+        u.sys_us    = RU_DELTA(ru_stime.tv_sec) * 1000000 + RU_DELTA(ru_stime.tv_usec);
+        u.minflt    = RU_DELTA(ru_minflt);
+        u.majflt    = RU_DELTA(ru_majflt);
+        u.nvcsw     = RU_DELTA(ru_nvcsw);
+        u.nivcsw    = RU_DELTA(ru_nivcsw);
+        u.maxrss_kb = self[1].ru_maxrss;
+        #undef RU_DELTA
+
+#ifndef __linux__
+        // That was the whole process, which on one of map's threads means
+        // the other workers too; not worth recording.
+        if (sh->threaded)
+            u.user_us = u.sys_us = u.minflt = u.majflt = u.nvcsw = u.nivcsw = 0;
+#endif
+
+        u.wall_us = 0;
+        usage_add(&u, &sh->spent);
+        usage_add(&spent, &sh->spent);
+        sh->spent = spent;
+    } else {
+        // wait4 hands back exactly this child's usage, no bookkeeping needed.
+        struct rusage ru;
+        status = fork_and_execvp(sh, argv[0], argv, io, &ru);
+        usage_from_rusage(&u, &ru);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    u.wall_us = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+                (end.tv_nsec - start.tv_nsec) / 1000;
+
+    stats_record(&sh->stats, argv[0], &u);
+    if (usage)
+        *usage = u;
+
+    return status;
+}
+
+/* run_command for a builtin which runs another command as its own, like
+ * time. A subcommand's output gets back the '\n' capturing took off it,
+ * as run_command takes it off again once the builtin returns.
+ */
+int run_wrapped(ysh_t* sh, char** argv, cmd_io_t* io, cmd_usage_t* usage) {
+    if (!io->capture)
+        return run_command(sh, argv, io, usage);
+
+    char* out = NULL;
+    cmd_io_t sub = *io;
+    sub.capture = &out;
+    int status = run_command(sh, argv, &sub, usage);
+    if (out && *out) {
+        builtin_output(io, out, strlen(out));
+        builtin_output(io, "\n", 1);
     }
-    return pid;
+    free_trap(out);
+    return status;
 }
 
-void execute(ast_t* tree, char** stdout) {
+/* Opens the file named by a resolved redirection node, relative to sh's
+ * working directory, and points the matching side of io at it. Returns
+ * the new descriptor, or -1.
+ */
+static int open_redir(ysh_t* sh, ast_t* redir, cmd_io_t* io) {
+    char* path = ast_str(redir->kids);
+
+    int fd;
+    if (redir->type == AST_REDIR_IN) {
+        fd = openat(sh->cwd, path, O_RDONLY | O_CLOEXEC);
+    } else if (redir->type == AST_REDIR_APP) {
+        fd = openat(sh->cwd, path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    } else {
+        fd = openat(sh->cwd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    }
+
+    if (fd == -1) {
+        dprintf(sh->err, "%s: %s\n", path, strerror(errno));
+    } else if (redir->type == AST_REDIR_IN) {
+        io->in = fd;
+    } else {
+        // Redirected output goes to the file, even from a subcommand.
+        io->out = fd;
+        io->capture = NULL;
+    }
+
+    return fd;
+}
+
+/* Runs a resolved command with io as its starting input and output (NULL
+ * for sh's defaults), and returns its exit status.
+ */
+int execute(ysh_t* sh, ast_t* tree, cmd_io_t* base) {
     // Important note; this function is only for fully resolved trees of commands.
     // If any unresolved subshells or groups exist, this function is undefined.
     // Additionally, tree must be of type AST_ROOT.
@@ -176,24 +472,48 @@ void execute(ast_t* tree, char** stdout) {
     // This function will eventually also perform shortest-unique-path
     // expansions. For example, typing /b/busy will resolve to /bin/busybox.
 
-    char*  prog;
+    // A syntax error was already reported by parse(); like sh, it's
+    // status 2.
+    if (tree->flags & AST_F_ERROR)
+        return 2;
+
+    int stage = alloc_stage_enter(ALLOC_EXECUTE);
+    cmd_io_t io = { sh->in, sh->out, NULL };
+    if (base)
+        io = *base;
+    int status = 0;
+    int redir_fds[tree->size + 1];
+    size_t redir_cnt = 0;
+
+    size_t argc = 0;
     char** argv = malloc_trap((tree->size + 1) * sizeof(char*));
     for (size_t i = 0; i < tree->size; i++) {
-        ast_t* str = &((ast_t*)tree->ptr)[i];
-        char *str_s = malloc_trap(str->size + 1);
-        memset(str_s, 0, str->size + 1);
-        memcpy(str_s, str->ptr, str->size);
-        argv[i] = str_s;
+        ast_t* str = &tree->kids[i];
+        if (AST_IS_REDIR(str->type)) {
+            // Later redirections win, same as everywhere else.
+            int fd = open_redir(sh, str, &io);
+            if (fd == -1) {
+                status = 1;
+                goto out;
+            }
+            redir_fds[redir_cnt++] = fd;
+            continue;
+        }
+        // Resolved strings are already terminated; no need to copy.
+        argv[argc++] = ast_str(str);
     }
-    argv[tree->size] = NULL;
-    prog = argv[0];
+    argv[argc] = NULL;
 
-    int builtin_chk = check_builtin(prog);
-    if (builtin_chk != -1) {
-        builtin_info[builtin_chk].func(prog, argv, stdout);
-    } else {
-        pid_t pid = fork_and_execvp(prog, argv, stdout);
-        int wstatus;
-        pid = waitpid(pid, &wstatus, 0);
-    }
+    if (!argc)
+        goto out;
+
+    status = run_command(sh, argv, &io, NULL);
+
+out:
+    for (size_t i = 0; i < redir_cnt; i++)
+        close(redir_fds[i]);
+    free_trap(argv);
+
+    alloc_stage_leave(stage);
+    return status;
 }
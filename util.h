@@ -1,9 +1,23 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include "ysh.h"
+
 #define BUF_CHUNKSIZ 64
 
-typedef int (*builtin_fn_t)(char*, char**, char**);
+// Where a single command's input and output go. Redirections replace in
+// and out; when capture is non-NULL (a subcommand), output is collected
+// there as a string instead of going to out.
+typedef struct {
+    int    in;
+    int    out;
+    char** capture;
+} cmd_io_t;
+
+struct cmd_usage_s; // stats.h
+struct rusage;
+
+typedef int (*builtin_fn_t)(ysh_t*, char*, char**, cmd_io_t*);
 
 typedef struct {
     char name[64];
@@ -12,18 +26,45 @@ typedef struct {
 
 void* malloc_trap(size_t malloc_size);
 void* realloc_trap(void *ptr, size_t malloc_size);
+void free_trap(void *ptr);
+void builtin_output(cmd_io_t* io, const char* str, size_t len);
+int fd_copy(int in, int out);
 char *read_input();
-pid_t fork_and_execvp(const char *file, char *const argv[], char** stdout);
-void execute(ast_t* tree, char** stdout);
+int fork_and_execvp(ysh_t* sh, const char *file, char *const argv[], cmd_io_t* io, struct rusage* ru);
+int run_command(ysh_t* sh, char** argv, cmd_io_t* io, struct cmd_usage_s* usage);
+int run_wrapped(ysh_t* sh, char** argv, cmd_io_t* io, struct cmd_usage_s* usage);
+int execute(ysh_t* sh, ast_t* tree, cmd_io_t* base);
 
 // Builtins; these are in the builtin subdir, and all must have the builtin_fn_t prototype
-int builtin_chdir(char* nam, char** argv, char** stdout);
+int builtin_chdir(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_cat(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_history(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+
+// Variables
+int builtin_set(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_export(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_unset(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+
+// Resource accounting
+int builtin_time(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_stats(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_allocs(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+
+// Child processes
+int builtin_timeout(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_memo(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+
+// Loops
+int builtin_repeat(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_for(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_while(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_map(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
 
 // Math builtins
-int builtin_add(char* nam, char** argv, char** stdout);
-int builtin_sub(char* nam, char** argv, char** stdout);
-int builtin_mul(char* nam, char** argv, char** stdout);
-int builtin_div(char* nam, char** argv, char** stdout);
-int builtin_modulo(char* nam, char** argv, char** stdout);
+int builtin_add(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_sub(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_mul(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_div(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
+int builtin_modulo(ysh_t* sh, char* nam, char** argv, cmd_io_t* io);
 
 #endif
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "vars.h"
+
+// Variables live in a plain chained hash table. Exported variables
+// additionally own one slot of the current environment snapshot, and
+// remember which one, so that changing or exporting a variable touches
+// exactly one envp entry instead of rebuilding the whole array on every
+// exec.
+//
+// Snapshots are copy-on-write. A launch takes a reference to the current
+// one and passes its envp to exec untouched. If a variable changes while
+// someone holds a reference, the store copies the pointer array first and
+// modifies the copy; the "NAME=value" strings themselves are refcounted
+// and shared between both.
+//
+// Each interpreter has its own store (see shell.h), so none of this needs
+// locking, with one exception. The children map runs its items in share
+// their parent's store (vars_share) rather than copying it, since the
+// parent does nothing until they're done: they look up whatever they
+// haven't set themselves in the parent's, and hand its snapshot to exec,
+// which is why snapshot refcounts are atomic. A variable set in a child
+// stays in the child; a change to the environment makes it copy the whole
+// store first, which bodies rarely need.
+
+typedef struct {
+    size_t refs;
+    char   str[];
+} env_str_t;
+
+#define ENV_STR(s) ((env_str_t*)((s) - offsetof(env_str_t, str)))
+
+typedef struct var_s {
+    struct var_s* next;
+    char*  name;
+    char*  value;
+    long   env_idx; // Slot in the environment, or -1 if not exported.
+} var_t;
+
+static char* var_strdup(const char* str) {
+    size_t len = strlen(str) + 1;
+    char* ret = malloc_trap(len);
+    memcpy(ret, str, len);
+    return ret;
+}
+
+static size_t var_hash(const char* name) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    for (; *name; name++) {
+        h ^= (uint8_t)*name;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static var_t** var_slot(vars_t* vars, const char* name) {
+    if (!vars->buckets) {
+        vars->buckets = 64;
+        vars->tab = malloc_trap(vars->buckets * sizeof(var_t*));
+        memset(vars->tab, 0, vars->buckets * sizeof(var_t*));
+    }
+
+    var_t** at = &vars->tab[var_hash(name) & (vars->buckets - 1)];
+    while (*at && strcmp((*at)->name, name))
+        at = &(*at)->next;
+    return at;
+}
+
+// Whether anything not found here is to be looked for in base.
+static int var_shared(vars_t* vars) {
+    return vars->base && !vars->split;
+}
+
+/* Finds name as var_get sees it: here, or else in base, and so on. Never
+ * changes anything, so it's safe on a store other threads are reading. A
+ * variable with no value was unset here, over one in base.
+ */
+static var_t* var_lookup(vars_t* vars, const char* name) {
+    size_t h = var_hash(name);
+    for (; vars; vars = var_shared(vars) ? vars->base : NULL) {
+        if (!vars->buckets)
+            continue;
+        for (var_t* var = vars->tab[h & (vars->buckets - 1)]; var; var = var->next) {
+            if (!strcmp(var->name, name))
+                return var;
+        }
+    }
+    return NULL;
+}
+
+static void var_grow(vars_t* vars) {
+    size_t old_buckets = vars->buckets;
+    var_t** old = vars->tab;
+
+    vars->buckets *= 2;
+    vars->tab = malloc_trap(vars->buckets * sizeof(var_t*));
+    memset(vars->tab, 0, vars->buckets * sizeof(var_t*));
+
+    for (size_t i = 0; i < old_buckets; i++) {
+        while (old[i]) {
+            var_t* var = old[i];
+            old[i] = var->next;
+            size_t b = var_hash(var->name) & (vars->buckets - 1);
+            var->next = vars->tab[b];
+            vars->tab[b] = var;
+        }
+    }
+    free_trap(old);
+}
+
+static var_t* var_find(vars_t* vars, const char* name, int create) {
+    var_t** at = var_slot(vars, name);
+    if (*at || !create)
+        return *at;
+
+    var_t* var = malloc_trap(sizeof(var_t));
+    var->next    = NULL;
+    var->name    = var_strdup(name);
+    var->value   = var_strdup("");
+    var->env_idx = -1;
+    *at = var;
+
+    if (++vars->count > vars->buckets)
+        var_grow(vars);
+
+    return var;
+}
+
+static char* env_str_new(const char* name, const char* value) {
+    size_t len = strlen(name) + strlen(value) + 2;
+    env_str_t* ent = malloc_trap(sizeof(env_str_t) + len);
+    ent->refs = 1;
+    snprintf(ent->str, len, "%s=%s", name, value);
+    return ent->str;
+}
+
+static void env_str_drop(char* str) {
+    env_str_t* ent = ENV_STR(str);
+    if (--ent->refs == 0)
+        free_trap(ent);
+}
+
+static env_snap_t* env_snap_new(size_t cap) {
+    env_snap_t* snap = malloc_trap(sizeof(env_snap_t));
+    snap->refs  = 1;
+    snap->count = 0;
+    snap->cap   = cap;
+    snap->envp  = malloc_trap((cap + 1) * sizeof(char*));
+    snap->envp[0] = NULL;
+    return snap;
+}
+
+/* Returns the current snapshot in a state where it may be modified,
+ * copying it first if anyone else has a reference to it.
+ */
+static env_snap_t* env_writable(vars_t* vars) {
+    if (!vars->env_cur)
+        vars->env_cur = env_snap_new(16);
+
+    if (vars->env_cur->refs > 1) {
+        env_snap_t* copy = env_snap_new(vars->env_cur->cap);
+        for (size_t i = 0; i < vars->env_cur->count; i++) {
+            copy->envp[i] = vars->env_cur->envp[i];
+            ENV_STR(copy->envp[i])->refs++;
+        }
+        copy->count = vars->env_cur->count;
+        copy->envp[copy->count] = NULL;
+
+        vars->env_cur->refs--;
+        vars->env_cur = copy;
+    }
+
+    return vars->env_cur;
+}
+
+void vars_import(vars_t* vars, char** envp) {
+    for (size_t i = 0; envp && envp[i]; i++) {
+        char* eq = strchr(envp[i], '=');
+        if (!eq)
+            continue;
+
+        size_t len = eq - envp[i];
+        char* name = malloc_trap(len + 1);
+        memcpy(name, envp[i], len);
+        name[len] = 0;
+
+        var_set(vars, name, eq + 1);
+        var_export(vars, name);
+        free_trap(name);
+    }
+}
+
+const char* var_get(vars_t* vars, const char* name) {
+    var_t* var = var_lookup(vars, name);
+    return var ? var->value : NULL;
+}
+
+/* Gives a shared store a copy of everything it sees through base, so that
+ * it can change the environment without base ever being written to.
+ */
+static void vars_split(vars_t* vars) {
+    vars_t own;
+    memset(&own, 0, sizeof(own));
+    vars_copy(&own, vars);
+    own.env_gen = vars->env_gen + 1;
+
+    vars_t* base = vars->base;
+    vars_free(vars);
+    *vars = own;
+    vars->base  = base;
+    vars->split = 1;
+}
+
+void var_set(vars_t* vars, const char* name, const char* value) {
+    assert(name && value);
+
+    // Changing an exported variable of base's changes the environment.
+    if (var_shared(vars)) {
+        var_t* seen = var_lookup(vars, name);
+        if (seen && seen->env_idx != -1)
+            vars_split(vars);
+    }
+
+    var_t* var = var_find(vars, name, 1);
+    free_trap(var->value);
+    var->value = var_strdup(value);
+
+    if (var->env_idx != -1) {
+        env_snap_t* snap = env_writable(vars);
+        env_str_drop(snap->envp[var->env_idx]);
+        snap->envp[var->env_idx] = env_str_new(var->name, var->value);
+        vars->env_gen++;
+    }
+}
+
+void var_unset(vars_t* vars, const char* name) {
+    if (var_shared(vars)) {
+        var_t* seen = var_lookup(vars, name);
+        if (!seen || !seen->value)
+            return;
+        if (seen->env_idx != -1) {
+            vars_split(vars);
+        } else {
+            // Kept with no value, to hide whatever base has.
+            var_t* var = var_find(vars, name, 1);
+            free_trap(var->value);
+            var->value = NULL;
+            return;
+        }
+    }
+
+    var_t** at = var_slot(vars, name);
+    var_t* var = *at;
+    if (!var)
+        return;
+
+    if (var->env_idx != -1) {
+        // Swap the last slot into the hole to keep envp dense.
+        env_snap_t* snap = env_writable(vars);
+        size_t last = snap->count - 1;
+
+        env_str_drop(snap->envp[var->env_idx]);
+        snap->envp[var->env_idx] = snap->envp[last];
+        vars->env_owner[var->env_idx]  = vars->env_owner[last];
+        vars->env_owner[var->env_idx]->env_idx = var->env_idx;
+
+        snap->envp[last] = NULL;
+        snap->count = last;
+        vars->env_gen++;
+    }
+
+    *at = var->next;
+    vars->count--;
+    free_trap(var->name);
+    free_trap(var->value);
+    free_trap(var);
+}
+
+void var_export(vars_t* vars, const char* name) {
+    if (var_shared(vars)) {
+        var_t* seen = var_lookup(vars, name);
+        if (seen && seen->value && seen->env_idx != -1)
+            return;
+        vars_split(vars);
+    }
+
+    var_t* var = var_find(vars, name, 1);
+    if (var->env_idx != -1)
+        return;
+
+    env_snap_t* snap = env_writable(vars);
+    if (snap->count == snap->cap) {
+        snap->cap *= 2;
+        snap->envp = realloc_trap(snap->envp, (snap->cap + 1) * sizeof(char*));
+    }
+    if (snap->count >= vars->env_owner_cap) {
+        vars->env_owner_cap = snap->cap;
+        vars->env_owner = realloc_trap(vars->env_owner, vars->env_owner_cap * sizeof(var_t*));
+    }
+
+    var->env_idx = snap->count;
+    vars->env_owner[snap->count] = var;
+    snap->envp[snap->count++] = env_str_new(var->name, var->value);
+    snap->envp[snap->count] = NULL;
+    vars->env_gen++;
+}
+
+/* Fills dst, which should be empty and not shared, with a copy of every
+ * variable src sees, exported or not the same way.
+ */
+void vars_copy(vars_t* dst, vars_t* src) {
+    if (var_shared(src))
+        vars_copy(dst, src->base);
+
+    for (size_t i = 0; i < src->buckets; i++) {
+        for (var_t* var = src->tab[i]; var; var = var->next) {
+            if (!var->value) {
+                var_unset(dst, var->name);
+                continue;
+            }
+            var_set(dst, var->name, var->value);
+            if (var->env_idx != -1)
+                var_export(dst, var->name);
+        }
+    }
+}
+
+/* Makes dst, which should be empty, see every variable in src without
+ * copying any. src mustn't change while dst is in use, but any number of
+ * threads may read it through stores shared from it at once.
+ */
+void vars_share(vars_t* dst, vars_t* src) {
+    // Whichever store really holds the environment needs a snapshot for
+    // env_acquire() to hand out; the first share is on its own thread.
+    vars_t* root = src;
+    while (var_shared(root))
+        root = root->base;
+    if (!root->env_cur)
+        root->env_cur = env_snap_new(16);
+
+    dst->base    = src;
+    dst->env_gen = src->env_gen;
+}
+
+static void vars_drop_all(vars_t* vars) {
+    for (size_t i = 0; i < vars->buckets; i++) {
+        while (vars->tab[i]) {
+            var_t* var = vars->tab[i];
+            vars->tab[i] = var->next;
+            free_trap(var->name);
+            free_trap(var->value);
+            free_trap(var);
+        }
+    }
+    vars->count = 0;
+}
+
+/* Puts a store made by vars_share() back as it was made, dropping whatever
+ * was set, unset or exported in it since. Costs nothing if nothing was.
+ */
+void vars_reset(vars_t* vars) {
+    vars_t* base = vars->base;
+    if (!base || (!vars->count && !vars->split))
+        return;
+
+    if (vars->split) {
+        vars_free(vars);
+        vars->base = base;
+    } else {
+        vars_drop_all(vars);
+    }
+    vars->env_gen = base->env_gen;
+}
+
+/* Frees every variable, and drops the store's reference to the current
+ * snapshot; anyone else still holding it keeps it alive. A store shared
+ * from another never touches that one.
+ */
+void vars_free(vars_t* vars) {
+    vars_drop_all(vars);
+    free_trap(vars->tab);
+    free_trap(vars->env_owner);
+    if (vars->env_cur)
+        env_release(vars->env_cur);
+    memset(vars, 0, sizeof(*vars));
+}
+
+env_snap_t* env_acquire(vars_t* vars) {
+    env_snap_t* snap;
+    if (var_shared(vars)) {
+        // Straight from the store that holds the environment, which
+        // vars_share() made sure has one, and which won't change it.
+        while (var_shared(vars))
+            vars = vars->base;
+        snap = vars->env_cur;
+    } else {
+        snap = env_writable(vars);
+    }
+    snap->refs++;
+    return snap;
+}
+
+void env_release(env_snap_t* snap) {
+    if (--snap->refs)
+        return;
+
+    for (size_t i = 0; i < snap->count; i++)
+        env_str_drop(snap->envp[i]);
+    free_trap(snap->envp);
+    free_trap(snap);
+}
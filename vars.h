@@ -0,0 +1,48 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// An immutable view of the exported environment, suitable for handing
+// straight to exec as envp. Take one with env_acquire() before starting
+// a launch and drop it with env_release() once the launch is done; the
+// variable store will never modify a snapshot somebody else is holding.
+typedef struct {
+    _Atomic size_t refs; // Shared stores (vars_share) take these from any thread.
+    size_t count;
+    size_t cap;
+    char** envp; // NULL-terminated, "NAME=value"
+} env_snap_t;
+
+// One interpreter's variables. All zero is an empty store.
+typedef struct vars_s {
+    struct var_s** tab;
+    size_t         buckets, count;
+
+    // Set for a store made by vars_share(). Anything not in tab is looked
+    // up in base, until something changes the environment; then all of
+    // base is copied in (split), and base is only kept for vars_reset().
+    struct vars_s* base;
+    int            split;
+
+    env_snap_t*    env_cur;
+    uint64_t       env_gen;    // Bumped whenever the environment changes.
+    struct var_s** env_owner;  // Which variable owns each envp slot.
+    size_t         env_owner_cap;
+} vars_t;
+
+void vars_import(vars_t* vars, char** envp);
+void vars_copy(vars_t* dst, vars_t* src);
+void vars_share(vars_t* dst, vars_t* src);
+void vars_reset(vars_t* vars);
+void vars_free(vars_t* vars);
+const char* var_get(vars_t* vars, const char* name);
+void var_set(vars_t* vars, const char* name, const char* value);
+void var_unset(vars_t* vars, const char* name);
+void var_export(vars_t* vars, const char* name);
+
+env_snap_t* env_acquire(vars_t* vars);
+void env_release(env_snap_t* snap);
+
+#endif
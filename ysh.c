@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "parse.h"
+#include "util.h"
+#include "shell.h"
+
+// The embedding interface from ysh.h; sh_main.c is just another user of
+// it. Nothing here keeps state of its own, so all of it is safe to call
+// from any number of threads as long as each sticks to its own ysh_t.
+
+extern char** environ;
+
+ysh_t* ysh_new(void) {
+    ysh_t* sh = malloc_trap(sizeof(ysh_t));
+    memset(sh, 0, sizeof(ysh_t));
+
+    sh->in  = 0;
+    sh->out = 1;
+    sh->err = 2;
+
+    // Start wherever the process is. If that can't be opened (it was
+    // removed, or we lack read permission on it) the process's own
+    // directory is used until the first cd.
+    sh->cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sh->cwd == -1)
+        sh->cwd = AT_FDCWD;
+
+    history_init(&sh->hist);
+
+    // Everything in our own environment starts out as an exported variable.
+    vars_import(&sh->vars, environ);
+
+    return sh;
+}
+
+void ysh_free(ysh_t* sh) {
+    if (!sh)
+        return;
+
+    history_close(&sh->hist);
+    stats_reset(&sh->stats);
+    memo_clear(&sh->memo);
+    vars_free(&sh->vars);
+    if (sh->cwd != AT_FDCWD)
+        close(sh->cwd);
+    free_trap(sh);
+}
+
+static int cwd_dup(ysh_t* sh) {
+    if (sh->cwd == AT_FDCWD)
+        return AT_FDCWD;
+    int fd = fcntl(sh->cwd, F_DUPFD_CLOEXEC, 0);
+    // Out of descriptors; same as ysh_new.
+    return fd == -1 ? AT_FDCWD : fd;
+}
+
+/* A lightweight copy of sh, for running some of its work on another thread
+ * (see builtin/map.c): the same variables, directory, descriptors and
+ * deadline, with no history and nothing memoized. Made on sh's thread, and
+ * handed back with ysh_child_join() once the other thread is done with it.
+ */
+ysh_t* ysh_child(ysh_t* sh) {
+    ysh_t* child = malloc_trap(sizeof(ysh_t));
+    memset(child, 0, sizeof(ysh_t));
+
+    child->debug = sh->debug;
+    child->threaded = 1;
+    child->in    = sh->in;
+    child->out   = sh->out;
+    child->err   = sh->err;
+    child->line_timeout = sh->line_timeout;
+    child->deadline.at  = sh->deadline.at;
+
+    child->cwd = cwd_dup(sh);
+    history_init(&child->hist);
+    vars_share(&child->vars, &sh->vars);
+
+    return child;
+}
+
+/* Puts back what a command run in child could have changed (variables,
+ * directory, anything memoized) the way they are in sh, so that whatever
+ * runs next starts out the same as the first thing did. Stats and the
+ * deadline carry on. Only reads sh, which mustn't be running anything
+ * meanwhile, so several threads can each reset their own child at once.
+ * Variables are shared with sh (see vars_share), so unless something
+ * changed them there's nothing to do for those.
+ */
+void ysh_child_reset(ysh_t* sh, ysh_t* child) {
+    vars_reset(&child->vars);
+
+    if (child->cwd != AT_FDCWD)
+        close(child->cwd);
+    child->cwd = cwd_dup(sh);
+
+    memo_clear(&child->memo);
+}
+
+/* Folds what child did into sh (its stats, what it used, and whether
+ * anything was stopped at the deadline), then frees it.
+ */
+void ysh_child_join(ysh_t* sh, ysh_t* child) {
+    stats_merge(&sh->stats, &child->stats);
+    usage_add(&sh->spent, &child->spent);
+    if (child->deadline.fired)
+        sh->deadline.fired = 1;
+    ysh_free(child);
+}
+
+static int run_line(ysh_t* sh, const char* line, char** capture) {
+    uint64_t prev = deadline_narrow(&sh->deadline, sh->line_timeout);
+
+    // parse() only ever reads the line.
+    ast_t* toks = parse(sh, (char*)line);
+    ast_t* cmd  = resolve(sh, toks);
+    cmd_io_t io = { sh->in, sh->out, capture };
+    int status = execute(sh, cmd, &io);
+    ast_free(cmd);
+    ast_free(toks);
+
+    deadline_restore(&sh->deadline, prev);
+    return status;
+}
+
+int ysh_run(ysh_t* sh, const char* line) {
+    assert(sh && line);
+    return run_line(sh, line, NULL);
+}
+
+int ysh_capture(ysh_t* sh, const char* line, char** out) {
+    assert(sh && line && out);
+
+    *out = NULL;
+    int status = run_line(sh, line, out);
+    if (!*out) {
+        *out = malloc_trap(1);
+        (*out)[0] = 0;
+    }
+    return status;
+}
+
+void ysh_set_io(ysh_t* sh, int in, int out, int err) {
+    sh->in  = in;
+    sh->out = out;
+    sh->err = err;
+}
+
+int ysh_chdir(ysh_t* sh, const char* path) {
+    assert(sh && path);
+
+    int fd = openat(sh->cwd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    if (sh->cwd != AT_FDCWD)
+        close(sh->cwd);
+    sh->cwd = fd;
+    return 0;
+}
+
+const char* ysh_get_var(ysh_t* sh, const char* name) {
+    return var_get(&sh->vars, name);
+}
+
+void ysh_set_var(ysh_t* sh, const char* name, const char* value) {
+    var_set(&sh->vars, name, value);
+}
+
+void ysh_export(ysh_t* sh, const char* name) {
+    var_export(&sh->vars, name);
+}
+
+void ysh_set_timeout(ysh_t* sh, uint64_t timeout_us) {
+    sh->line_timeout = timeout_us;
+}
+
+void ysh_set_debug(ysh_t* sh, int debug) {
+    sh->debug = debug;
+}
+
+void ysh_child_limit(size_t max) {
+    child_limit_set(max);
+}
@@ -0,0 +1,78 @@
+#ifndef YSH_H
+#define YSH_H
+
+// Embedding interface, as built into libysh.a and libysh.so.
+//
+// Everything an interpreter knows lives in its ysh_t: variables and the
+// exported environment, working directory, deadlines, command stats,
+// history and where output goes. Any number of them may exist at once,
+// and each may be used from a different thread; a single ysh_t must only
+// be used by one thread at a time.
+//
+// A few things are shared by the whole process, by necessity or design:
+// the cap on live children (ysh_child_limit), allocation accounting, and
+// reports of the shell's own failures (running out of memory, trouble with
+// the history file), which go to fd 2. Errors from commands go to the
+// interpreter's error descriptor.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// libysh.so exports these and nothing else; the rest of it is built with
+// -fvisibility=hidden.
+#ifdef __GNUC__
+#define YSH_API __attribute__((visibility("default")))
+#else
+#define YSH_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ysh_s ysh_t;
+
+YSH_API ysh_t* ysh_new(void);
+YSH_API void ysh_free(ysh_t* sh);
+
+/* Runs one line, and returns the exit status of its command. */
+YSH_API int ysh_run(ysh_t* sh, const char* line);
+
+/* Same as ysh_run, but the line's output is returned in *out (stripped
+ * of the last '\n', like a subcommand) instead of being written. *out
+ * is always set, and must be released with free().
+ */
+YSH_API int ysh_capture(ysh_t* sh, const char* line, char** out);
+
+/* Where commands read from and write to when they aren't redirected, and
+ * where errors are reported. Defaults to 0, 1 and 2. The descriptors are
+ * not closed by ysh_free.
+ */
+YSH_API void ysh_set_io(ysh_t* sh, int in, int out, int err);
+
+/* Changes the working directory of sh alone; the process's own is never
+ * touched. Relative paths are taken from sh's current one. Returns -1
+ * with errno set on failure.
+ */
+YSH_API int ysh_chdir(ysh_t* sh, const char* path);
+
+YSH_API const char* ysh_get_var(ysh_t* sh, const char* name);
+YSH_API void ysh_set_var(ysh_t* sh, const char* name, const char* value);
+YSH_API void ysh_export(ysh_t* sh, const char* name);
+
+/* Deadline given to every line run, subcommands and all; 0 for none. */
+YSH_API void ysh_set_timeout(ysh_t* sh, uint64_t timeout_us);
+
+/* Prints each tree as it's parsed and resolved, to sh's output. */
+YSH_API void ysh_set_debug(ysh_t* sh, int debug);
+
+/* Most children alive at once across every ysh_t in the process; 0 for
+ * no limit.
+ */
+YSH_API void ysh_child_limit(size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif